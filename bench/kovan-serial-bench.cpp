@@ -0,0 +1,250 @@
+// Loopback benchmarks for the serial server's hot paths.
+//
+// A ServerThread serves one end of a socketpair while this process
+// drives the other end through the same TransportLayer/KovanSerial stack
+// a real client uses. Each benchmark prints one JSON object per line:
+//   {"bench": "...", "iterations": N, "mean_us": ..., "p50_us": ...,
+//    "p99_us": ..., "bytes": ..., "mb_per_s": ...}
+//
+// Usage: kovan-serial-bench [iterations]
+// Uploads and compiles write under USER_ROOT, so run it on a device or
+// a scratch image, and against a controller without a password.
+
+#include <QCoreApplication>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFile>
+
+#include <kovanserial/transport_layer.hpp>
+#include <kovanserial/kovan_serial.hpp>
+#include <kovanserial/command_types.hpp>
+#include <kar/kar.hpp>
+
+#include "server_thread.hpp"
+#include "socket_transmitter.hpp"
+#include "config_cache.hpp"
+#include "constants.hpp"
+
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#define TIMEOUT_MS 10000
+#define BENCH_PROJECT "__kovan_serial_bench__"
+
+class Samples
+{
+public:
+	void add(const qint64 nsecs)
+	{
+		m_samples.push_back(nsecs);
+	}
+
+	void report(const char *bench, const quint64 bytes = 0)
+	{
+		if(m_samples.empty()) {
+			printf("{\"bench\": \"%s\", \"error\": \"no successful iterations\"}\n", bench);
+			return;
+		}
+
+		std::sort(m_samples.begin(), m_samples.end());
+		qint64 total = 0;
+		for(size_t i = 0; i < m_samples.size(); ++i) total += m_samples[i];
+
+		const double mean = total / 1000.0 / m_samples.size();
+		const double p50 = m_samples[m_samples.size() / 2] / 1000.0;
+		const double p99 = m_samples[(m_samples.size() * 99) / 100] / 1000.0;
+		const double mbps = bytes && total ? (bytes * m_samples.size()) / (total / 1e9) / 1e6 : 0.0;
+		printf("{\"bench\": \"%s\", \"iterations\": %u, \"mean_us\": %.1f, \"p50_us\": %.1f, "
+			"\"p99_us\": %.1f, \"bytes\": %llu, \"mb_per_s\": %.2f}\n", bench,
+			unsigned(m_samples.size()), mean, p50, p99, (unsigned long long)bytes, mbps);
+		fflush(stdout);
+	}
+
+private:
+	std::vector<qint64> m_samples;
+};
+
+class Client
+{
+public:
+	Client(const int fd)
+		: m_transmitter(fd),
+		m_transport(&m_transmitter),
+		m_proto(&m_transport)
+	{
+	}
+
+	KovanSerial *proto()
+	{
+		return &m_proto;
+	}
+
+	// Issues a file action and collects the file the server answers with,
+	// skipping the confirmation and progress packets in between.
+	bool action(const std::string &action, const std::string &dest, std::string &out)
+	{
+		if(!m_proto.sendFileAction(action, dest)) return false;
+
+		Packet p;
+		for(;;) {
+			if(m_proto.next(p, TIMEOUT_MS) != TransportLayer::Success) return false;
+			if(p.type == Command::FileHeader) break;
+		}
+
+		Command::FileHeaderData header;
+		p.as(header);
+		std::ostringstream stream;
+		if(!m_proto.confirmFile(true) || !m_proto.recvFile(header.size, &stream, TIMEOUT_MS)) return false;
+		out = stream.str();
+		return true;
+	}
+
+	bool upload(const std::string &dest, const QByteArray &data)
+	{
+		std::istringstream stream(std::string(data.constData(), data.size()));
+		return m_proto.sendFile(dest, "kar", &stream);
+	}
+
+private:
+	SocketTransmitter m_transmitter;
+	TransportLayer m_transport;
+	KovanSerial m_proto;
+};
+
+static QByteArray randomBytes(const int size)
+{
+	QByteArray ret(size, 0);
+	for(int i = 0; i < size; ++i) ret[i] = rand() & 0xFF;
+	return ret;
+}
+
+static void benchKnock(Client &client, const int iterations)
+{
+	Samples samples;
+	for(int i = 0; i < iterations; ++i) {
+		QElapsedTimer timer;
+		timer.start();
+		if(client.proto()->knockKnock(TIMEOUT_MS)) samples.add(timer.nsecsElapsed());
+	}
+	samples.report("knock_knock_rtt");
+}
+
+static void benchUpload(Client &client, const int iterations, const int size)
+{
+	const QByteArray data = randomBytes(size);
+	Samples samples;
+	for(int i = 0; i < iterations; ++i) {
+		QElapsedTimer timer;
+		timer.start();
+		if(client.upload(BENCH_PROJECT, data)) samples.add(timer.nsecsElapsed());
+	}
+	samples.report(QString("upload_%1k").arg(size / 1024).toLatin1().constData(), size);
+}
+
+static void benchRead(Client &client, const int iterations, const int size)
+{
+	QTemporaryFile file;
+	if(!file.open()) return;
+	file.write(randomBytes(size));
+	file.flush();
+
+	Samples samples;
+	for(int i = 0; i < iterations; ++i) {
+		std::string out;
+		QElapsedTimer timer;
+		timer.start();
+		if(client.action(COMMAND_ACTION_READ, file.fileName().toStdString(), out)
+			&& int(out.size()) == size) samples.add(timer.nsecsElapsed());
+	}
+	samples.report(QString("read_%1k").arg(size / 1024).toLatin1().constData(), size);
+}
+
+static void benchList(Client &client, const int iterations)
+{
+	// 8 directories of 32 files each
+	const QString root = QDir::tempPath() + "/kovan-serial-bench-tree";
+	for(int d = 0; d < 8; ++d) {
+		const QString dir = root + QString("/dir%1").arg(d);
+		QDir().mkpath(dir);
+		for(int f = 0; f < 32; ++f) {
+			QFile file(dir + QString("/file%1").arg(f));
+			if(file.open(QIODevice::WriteOnly)) file.write(randomBytes(512));
+		}
+	}
+
+	Samples flat;
+	Samples recursive;
+	for(int i = 0; i < iterations; ++i) {
+		std::string out;
+		QElapsedTimer timer;
+		timer.start();
+		if(client.action(COMMAND_ACTION_READ, (root + "/dir0").toStdString(), out)) flat.add(timer.nsecsElapsed());
+
+		timer.restart();
+		if(client.action(COMMAND_ACTION_LIST, ("4:h:" + root).toStdString(), out)) recursive.add(timer.nsecsElapsed());
+	}
+	flat.report("list_one_level");
+	recursive.report("list_recursive_hashed");
+}
+
+static void benchCompile(Client &client, const int iterations)
+{
+	kiss::KarPtr archive = kiss::Kar::create();
+	archive->setFile("main.c", "int main()\n{\n\treturn 0;\n}\n");
+	const QString path = QDir::tempPath() + "/" BENCH_PROJECT ".kar";
+	QFile file(path);
+	if(!archive->save(path) || !file.open(QIODevice::ReadOnly)) return;
+	if(!client.upload(BENCH_PROJECT, file.readAll())) return;
+
+	// The first compile warms the build tree and compile cache; the rest
+	// measure dispatch, progress reporting and result delivery.
+	std::string out;
+	client.action(COMMAND_ACTION_COMPILE, BENCH_PROJECT, out);
+
+	Samples samples;
+	for(int i = 0; i < iterations; ++i) {
+		QElapsedTimer timer;
+		timer.start();
+		if(client.action(COMMAND_ACTION_COMPILE, BENCH_PROJECT, out)) samples.add(timer.nsecsElapsed());
+	}
+	samples.report("compile_dispatch_cached");
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	ConfigCache config;
+
+	const int iterations = argc > 1 ? qMax(1, atoi(argv[1])) : 100;
+
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	SocketTransmitter serverSide(fds[0]);
+	ServerThread server(&serverSide);
+	server.start();
+
+	{
+		Client client(fds[1]);
+		benchKnock(client, iterations);
+		benchUpload(client, qMax(1, iterations / 10), 64 * 1024);
+		benchUpload(client, qMax(1, iterations / 10), 4 * 1024 * 1024);
+		benchRead(client, qMax(1, iterations / 10), 64 * 1024);
+		benchRead(client, qMax(1, iterations / 10), 4 * 1024 * 1024);
+		benchList(client, qMax(1, iterations / 10));
+		benchCompile(client, qMax(1, iterations / 10));
+		client.proto()->hangup();
+	}
+
+	server.stop();
+	server.wait();
+	return 0;
+}
@@ -8,8 +8,8 @@
  * Do not edit! All changes made to it will be lost.
  */
 
-#ifndef SERIAL_H_1359245659
-#define SERIAL_H_1359245659
+#ifndef SERIAL_H_1792240913
+#define SERIAL_H_1792240913
 
 #include <QtCore/QObject>
 #include <QtCore/QByteArray>
@@ -36,6 +36,12 @@ public:
     ~Serial();
 
 public Q_SLOTS: // METHODS
+    inline QDBusPendingReply<QString> Stats()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QLatin1String("Stats"), argumentList);
+    }
+
 Q_SIGNALS: // SIGNALS
     void Run(const QString &path);
 };
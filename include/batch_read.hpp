@@ -0,0 +1,39 @@
+#ifndef _BATCH_READ_HPP_
+#define _BATCH_READ_HPP_
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+// Reads many files under USER_ROOT in one go. The request is either a
+// newline separated list of paths or a single glob(3) pattern. The bundle
+// is serialized with QDataStream:
+//   quint32 file count, then per file
+//   QByteArray path as requested or matched, UTF-8
+//   quint8     status, one of BatchRead::Status
+//   QByteArray contents, empty unless status is Ok
+// A request naming more than BATCH_MAX_FILES files ends with one more
+// entry whose status is Truncated, carrying the request's first line.
+// Glob matches outside USER_ROOT are left out entirely.
+class BatchRead
+{
+public:
+	enum Status
+	{
+		Ok = 0,
+		Unreadable,
+		OutsideRoot,
+		TooLarge,
+		Truncated
+	};
+	
+	// False only if the request names no files at all.
+	static bool build(const QString &request, QByteArray &out);
+	
+private:
+	static QStringList expand(const QString &request, bool &truncated);
+	static bool isUnderRoot(const QString &path);
+	static QString root();
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _BUILD_TREE_HPP_
+#define _BUILD_TREE_HPP_
+
+#include <QString>
+#include <QStringList>
+#include <QSet>
+
+#include <kar/kar.hpp>
+
+// Persistent build directory for one project under BUILD_ROOT. Sources
+// are synced from the archive without touching unchanged files, so their
+// mtimes stay valid for incremental rebuilds of the objects next to them.
+class BuildTree
+{
+public:
+	// Holds the project's build lock for its lifetime; one build per
+	// project at a time. Locks are dropped once no build uses them.
+	class Lock
+	{
+	public:
+		Lock(const BuildTree &tree);
+		~Lock();
+		
+	private:
+		Lock(const Lock &);
+		Lock &operator =(const Lock &);
+		
+		QString m_path;
+	};
+	
+	BuildTree(const QString &name);
+	
+	// Project names become a directory under BUILD_ROOT, so they must be a
+	// single path component.
+	static bool isValidName(const QString &name);
+	
+	QString sourcePath() const;
+	QString objectPath() const;
+	QString objectFor(const QString &source) const;
+	
+	// Writes the archive files whose contents differ from the tree, removes
+	// files the archive no longer contains and returns every source path.
+	// Fails if an archive path would land outside the source dir.
+	bool sync(const kiss::KarPtr &archive, QStringList &files);
+	
+	// Drops all objects if the toolchain fingerprint changed since the last build.
+	void setFingerprint(const QString &fingerprint);
+	
+	// Removes the least recently built trees once BUILD_ROOT exceeds
+	// BUILD_ROOT_MAX_BYTES. Trees that are locked or waited on are kept.
+	static void evict();
+	
+private:
+	static bool sameContents(const QString &path, const QByteArray &data);
+	static void removeStale(const QString &dir, const QSet<QString> &keep);
+	
+	QString m_path;
+};
+
+#endif
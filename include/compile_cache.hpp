@@ -0,0 +1,46 @@
+#ifndef _COMPILE_CACHE_HPP_
+#define _COMPILE_CACHE_HPP_
+
+#include <QString>
+#include <QReadWriteLock>
+#include <QAtomicInt>
+
+#include <pcompiler/output.hpp>
+
+// Persistent cache of successful compiles, keyed by a hash of the archive
+// bytes, the platform hints and the injected runtime shim. An entry holds
+// the serialized OutputList and a copy of the installed binary directory;
+// projects that install libraries or headers are not cached.
+// Least recently used entries are evicted once the cache exceeds
+// COMPILE_CACHE_MAX_BYTES. lookup() and store() touch USER_ROOT/bin/<name>
+// and must be called with that project's BuildTree::Lock held.
+class CompileCache
+{
+public:
+	static QString key(const QString &archivePath, const QString &name);
+	
+	bool lookup(const QString &key, const QString &name, Compiler::OutputList &output);
+	void store(const QString &key, const QString &name, const Compiler::OutputList &output);
+	
+	int hits() const;
+	int misses() const;
+	
+	static CompileCache *instance();
+	
+private:
+	CompileCache();
+	
+	static bool isCacheable(const Compiler::OutputList &output);
+	QString entryPath(const QString &key) const;
+	static QString binPath(const QString &name);
+	void evict();
+	
+	QString m_root;
+	// Read for copying out of entries, write for publishing and eviction
+	QReadWriteLock m_lock;
+	QAtomicInt m_hits;
+	QAtomicInt m_misses;
+	QAtomicInt m_staging;
+};
+
+#endif
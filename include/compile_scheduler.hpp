@@ -0,0 +1,41 @@
+#ifndef _COMPILE_SCHEDULER_HPP_
+#define _COMPILE_SCHEDULER_HPP_
+
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+class CompileWorker;
+
+typedef QSharedPointer<CompileWorker> CompileWorkerPtr;
+
+// Queues compile jobs from every session and runs at most one per core.
+// Workers are reference counted and reclaimed once both the pool and the
+// submitting session are done with them.
+class CompileScheduler
+{
+public:
+	~CompileScheduler();
+	
+	void enqueue(const CompileWorkerPtr &worker);
+	
+	// Cancels every queued or running job for the given project.
+	bool cancel(const QString &name);
+	
+	int maxConcurrent() const;
+	
+	static CompileScheduler *instance();
+	
+private:
+	friend class CompileTask;
+	
+	CompileScheduler();
+	void finished(const CompileWorkerPtr &worker);
+	
+	QThreadPool m_pool;
+	QMutex m_mutex;
+	QList<CompileWorkerPtr> m_active;
+};
+
+#endif
@@ -1,36 +1,111 @@
 #ifndef _COMPILE_WORKER_HPP_
 #define _COMPILE_WORKER_HPP_
 
-#include <QThread>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <string>
 
 #include <kar/kar.hpp>
 #include <pcompiler/output.hpp>
 #include <pcompiler/progress.hpp>
 
-class KovanSerial;
+#include "unit_compiler.hpp"
+#include "compile_scheduler.hpp"
+
+class BuildTree;
 
-class CompileWorker : public QThread, public Compiler::Progress
+// One compile job. Workers are run by the CompileScheduler's pool; the
+// session that submitted the job polls progress() and wait() and is the
+// only party that talks to the client.
+class CompileWorker : public Compiler::Progress, public UnitCompiler::Listener
 {
 public:
-	CompileWorker(const kiss::KarPtr &archive, KovanSerial *proto, QObject *parent = 0);
+	// A message for a streaming client: "co" carries one serialized
+	// Compiler::Output, "cl" a source path and one line of compiler stderr.
+	struct Diagnostic
+	{
+		std::string metadata;
+		QByteArray data;
+	};
+	
+	enum State
+	{
+		Queued,
+		Running,
+		Finished,
+		Cancelled
+	};
+	
+	CompileWorker(const kiss::KarPtr &archive);
+	
+	// A job for an uploaded project, with the runtime shim injected into
+	// C projects and the cache key set. Null if there is no such archive.
+	static CompileWorkerPtr forProject(const QString &name);
 	
 	void run();
 	
-	const Compiler::OutputList &output() const;
+	// Empty for streaming jobs, whose output is handed out as diagnostics.
+	// Returns a copy, since a cancelled job may still be running.
+	Compiler::OutputList output() const;
 	
 	void setName(const QString &name);
 	const QString &name() const;
 	
+	// Links the cached rc/target.c object into the program; set for C/C++ projects.
+	void setTargetShim(const bool targetShim);
+	bool hasTargetShim() const;
+	
+	// Key into the CompileCache; an empty key bypasses the cache.
+	void setCacheKey(const QString &cacheKey);
+	const QString &cacheKey() const;
+	
+	// Must be set before the job is enqueued.
+	void setStreaming(const bool streaming);
+	bool isStreaming() const;
+	QList<Diagnostic> takeDiagnostics();
+	
 	void progress(double fraction);
+	double fraction() const;
+	
+	void line(const QString &source, const QByteArray &line);
+	
+	State state() const;
+	
+	// A queued job is dropped without compiling. A running job finishes its
+	// current compile but its output is discarded and nothing is installed.
+	void cancel();
+	bool isCancelled() const;
+	
+	// Returns true once the job is Finished or Cancelled.
+	bool wait(const unsigned long timeout);
 	
 private:
-	Compiler::OutputList compile();
-	static QString tempPath();
+	friend class UnitTask;
+	
+	Compiler::OutputList compile(BuildTree &tree);
+	static bool isSuccess(const Compiler::OutputList &output);
+	void setState(const State state);
+	void setStage(const double base, const double span);
+	void post(const Compiler::Output &output);
+	void post(const Compiler::OutputList &output);
 	
 	kiss::KarPtr m_archive;
-	KovanSerial *m_proto;
 	Compiler::OutputList m_output;
 	QString m_name;
+	QString m_cacheKey;
+	bool m_streaming;
+	bool m_targetShim;
+	
+	mutable QMutex m_mutex;
+	QWaitCondition m_done;
+	State m_state;
+	bool m_cancelRequested;
+	double m_fraction;
+	double m_stageBase;
+	double m_stageSpan;
+	QList<Diagnostic> m_diagnostics;
 };
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef _CONFIG_CACHE_HPP_
+#define _CONFIG_CACHE_HPP_
+
+#include <QObject>
+#include <QString>
+#include <QReadWriteLock>
+#include <QAtomicInt>
+
+#include <string>
+
+class QFileSystemWatcher;
+
+// Parsed view of DEVICE_SETTINGS. The file is loaded once and reloaded
+// only when inotify reports a change, so readers never touch the disk.
+// Constructed once in main() on the main thread, which owns the watcher;
+// it must outlive every server thread.
+class ConfigCache : public QObject
+{
+Q_OBJECT
+public:
+	ConfigCache(QObject *parent = 0);
+	~ConfigCache();
+	
+	// Bumped whenever a reload changes any parsed value. Readers compare it
+	// against the value they last applied to skip redundant work.
+	int generation() const;
+	
+	// loaded is false when DEVICE_SETTINGS could not be read; the other
+	// values are meaningless then.
+	int password(bool &loaded, bool &passworded, std::string &password) const;
+	QString deviceName() const;
+	
+	static ConfigCache *instance();
+	
+signals:
+	void changed();
+	
+private slots:
+	void reload();
+	
+private:
+	void watch();
+	
+	mutable QReadWriteLock m_lock;
+	QAtomicInt m_generation;
+	bool m_loaded;
+	bool m_passworded;
+	std::string m_password;
+	QString m_deviceName;
+	QFileSystemWatcher *m_watcher;
+};
+
+#endif
@@ -5,5 +5,42 @@
 
 #define USER_ROOT ("/kovan")
 #define DEVICE_SETTINGS ("/etc/kovan/device.conf")
+#define PLATFORM_HINTS ("/etc/kovan/platform.hints")
+
+#define BUILD_ROOT ("/kovan/.build")
+#define COMPILE_CACHE_ROOT ("/kovan/.cache/compile")
+#define COMPILE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+// Least recently built project trees are removed beyond this
+#define BUILD_ROOT_MAX_BYTES (128 * 1024 * 1024)
+
+// File actions handled by this server in addition to kovanserial's
+#define COMMAND_ACTION_CANCEL ("cancel")
+#define COMMAND_ACTION_COMPILE_STREAM ("compile_stream")
+#define COMMAND_ACTION_UPLOAD_STATUS ("upload_status")
+#define COMMAND_ACTION_SCREENSHOT_RLE ("screenshot_rle")
+#define COMMAND_ACTION_LIST ("list")
+#define COMMAND_ACTION_KAR_SIGNATURE ("kar_signature")
+#define COMMAND_ACTION_COMPRESSION ("compression")
+#define COMMAND_ACTION_STATS ("stats")
+#define COMMAND_ACTION_SESSION_TICKET ("session_ticket")
+#define COMMAND_ACTION_RESUME_SESSION ("resume_session")
+#define COMMAND_ACTION_PIPE ("pipe")
+#define COMMAND_ACTION_PIPE_COLLECT ("pipe_collect")
+#define COMMAND_ACTION_READ_BATCH ("read_batch")
+
+// Lifetime of a ticket from COMMAND_ACTION_SESSION_TICKET
+#define SESSION_TICKET_TTL_MS (10 * 60 * 1000)
+
+// Query/response discovery. A datagram holding DISCOVERY_PROBE sent to the
+// group is answered with the controller's advert, unicast to the sender.
+#define DISCOVERY_GROUP ("239.255.42.43")
+#define DISCOVERY_PORT 8375
+#define DISCOVERY_PROBE ("kovan-discover")
+// Unsolicited adverts are only a fallback for listen-only clients
+#define ADVERT_PULSE_MS 30000
+
+// Upper bound on concurrently served TCP connections; a classroom of
+// laptops must fit, since clients past it are refused
+#define TCP_MAX_SESSIONS 32
 
 #endif
@@ -0,0 +1,35 @@
+#ifndef _DELTA_SYNC_HPP_
+#define _DELTA_SYNC_HPP_
+
+#include <QByteArray>
+#include <QString>
+
+// rsync-style block delta transfer for archives the server already holds.
+//
+// A signature (QDataStream) describes the server's copy:
+//   quint32 block size, quint64 file size, QByteArray hex MD5 of the file,
+//   quint32 block count, then per block quint32 weak and QByteArray strong
+// The weak sum is rsync's rolling checksum, (b << 16) | a with
+//   a = sum of bytes mod 2^16, b = sum of (n - i) * byte[i] mod 2^16,
+// and the strong sum is the block's raw 16 byte MD5. The last block may
+// be short.
+//
+// A delta (QDataStream) rebuilds the new file from that copy:
+//   QByteArray hex MD5 of the base it was computed against
+//   QByteArray hex MD5 of the result
+//   quint32 block size
+//   then ops until 'E': 'C' quint32 first block, quint32 block count
+//                       'L' QByteArray literal bytes
+class DeltaSync
+{
+public:
+	static bool signature(const QString &path, const quint32 blockSize, QByteArray &out);
+	
+	// Writes the rebuilt file next to path and renames it over path once
+	// its MD5 matches. Gives up as soon as the result outgrows maxBytes.
+	static bool apply(const QString &path, const QByteArray &delta, const qint64 maxBytes);
+	
+	static quint32 weakSum(const char *data, const int len);
+};
+
+#endif
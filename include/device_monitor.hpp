@@ -0,0 +1,40 @@
+#ifndef _DEVICE_MONITOR_HPP_
+#define _DEVICE_MONITOR_HPP_
+
+#include <QString>
+
+// Kernel uevents (the netlink feed udev itself listens to). Lets the
+// server react to gadget disconnects and device nodes appearing instead
+// of finding out on its next periodic check.
+class DeviceMonitor
+{
+public:
+	struct Event
+	{
+		QString action;
+		QString subsystem;
+		QString devName;
+	};
+	
+	DeviceMonitor();
+	~DeviceMonitor();
+	
+	bool open();
+	void close();
+	bool isOpen() const;
+	
+	// -1 while closed, so it can be handed straight to poll()
+	int fd() const;
+	
+	// Waits up to timeout ms for one event. A timeout of 0 only drains
+	// what is already queued.
+	bool next(Event &event, const int timeout = 0);
+	
+private:
+	DeviceMonitor(const DeviceMonitor &);
+	DeviceMonitor &operator =(const DeviceMonitor &);
+	
+	int m_fd;
+};
+
+#endif
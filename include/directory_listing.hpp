@@ -0,0 +1,34 @@
+#ifndef _DIRECTORY_LISTING_HPP_
+#define _DIRECTORY_LISTING_HPP_
+
+#include <QByteArray>
+#include <QString>
+
+// Walks a directory tree and serializes every entry with QDataStream:
+//   quint32 entry count, then per entry
+//   QByteArray path relative to the root, UTF-8
+//   quint8     type: 'd', 'f', 'l' or '?'
+//   quint64    size in bytes
+//   qint64     mtime, seconds since the epoch
+//   quint32    st_mode
+//   QByteArray hex MD5 of a regular file's contents, empty unless requested
+// Symlinked directories are listed but not descended into, and files on
+// procfs or sysfs are never hashed. A walk that hits LIST_MAX_ENTRIES or
+// LIST_MAX_BYTES stops there and ends with one extra entry of type 't'
+// and an empty path.
+class DirectoryListing
+{
+public:
+	static bool build(const QString &root, const int depth, const bool hashes, QByteArray &out);
+	
+	// The original one-level text format of COMMAND_ACTION_READ on a
+	// directory: one "<type char> <name>" line per entry.
+	static bool flat(const QString &path, QByteArray &out);
+	
+private:
+	// False once a limit was hit and the walk stopped
+	static bool walk(QDataStream &stream, const QString &root, const QString &relative,
+		const int depth, const bool hashes, quint32 &count);
+};
+
+#endif
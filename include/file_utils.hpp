@@ -0,0 +1,13 @@
+#ifndef _FILE_UTILS_HPP_
+#define _FILE_UTILS_HPP_
+
+#include <QString>
+
+namespace FileUtils
+{
+	bool removeRecursively(const QString &path);
+	bool copyRecursively(const QString &from, const QString &to);
+	qint64 diskUsage(const QString &path);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _FRAMEBUFFER_HPP_
+#define _FRAMEBUFFER_HPP_
+
+#include <QByteArray>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QString>
+
+// The Linux framebuffer mapped into this process. Grabs copy pixels out
+// of the mapping directly; nothing touches the shell or the flash. The
+// screen info is re-read on every grab, so mode changes are picked up,
+// and a device that failed to open is retried.
+class Framebuffer
+{
+public:
+	~Framebuffer();
+	
+	bool isOpen();
+	
+	int width();
+	int height();
+	int bitsPerPixel();
+	
+	// Everything `cat /dev/fb0` would produce, for raw565 clients.
+	QByteArray grabRaw();
+	
+	// The visible area with row padding removed, width * height pixels,
+	// along with the dimensions it was grabbed at.
+	QByteArray grab(int &width, int &height);
+	
+	static Framebuffer *instance();
+	
+private:
+	Framebuffer(const QString &device);
+	bool open();
+	void close();
+	
+	QString m_device;
+	QMutex m_mutex;
+	int m_fd;
+	QElapsedTimer m_lastTry;
+	unsigned char *m_data;
+	size_t m_size;
+	int m_width;
+	int m_height;
+	int m_bpp;
+	int m_lineLength;
+	int m_offset;
+};
+
+#endif
@@ -2,9 +2,15 @@
 #define _HEARTBEAT_HPP_
 
 #include <QObject>
+#include <QByteArray>
 
 #include <kovanserial/udp_advertiser.hpp>
 
+class QUdpSocket;
+
+// Makes the controller discoverable. Clients multicast DISCOVERY_PROBE and
+// get the advert back immediately; a slow periodic pulse remains for
+// clients that only listen.
 class Heartbeat : public QObject
 {
 Q_OBJECT
@@ -16,12 +22,16 @@ public:
 	const Advert &advert() const;
 	
 private slots:
-	void reset();
 	void beat();
+	void respond();
+	void updateAdvert();
 	
 private:
 	UdpAdvertiser m_advertiser;
 	Advert m_advert;
+	// m_advert as sent on the wire, rebuilt only when the advert changes
+	QByteArray m_advertData;
+	QUdpSocket *m_responder;
 };
 
 #endif
@@ -0,0 +1,59 @@
+#ifndef _MAPPED_FILE_HPP_
+#define _MAPPED_FILE_HPP_
+
+#include <QString>
+#include <QByteArray>
+
+#include <istream>
+#include <streambuf>
+
+// Read-only memory mapping of a file exposed as a std::istream. The
+// stream's get area points straight into the mapping, so reads copy
+// from the page cache once instead of through a filebuf. Devices,
+// empty files and procfs/sysfs files are read into memory instead.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	
+	bool open(const QString &path);
+	void close();
+	bool isOpen() const;
+	
+	// True once the file shrank under the mapping; the missing bytes
+	// read as zeros and whatever was read from data() must be discarded.
+	bool isTruncated() const;
+	
+	const char *data() const;
+	size_t size() const;
+	
+	std::istream *stream();
+	
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator =(const MappedFile &);
+	
+	bool map(const int fd, const size_t size);
+	bool readAll(const int fd);
+	
+	class Buffer : public std::streambuf
+	{
+	public:
+		void reset(const char *data, const size_t size);
+		
+	protected:
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+	};
+	
+	void *m_data;
+	size_t m_size;
+	int m_slot;
+	QByteArray m_copy;
+	bool m_open;
+	Buffer m_buffer;
+	std::istream m_stream;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _MD5_DIGEST_HPP_
+#define _MD5_DIGEST_HPP_
+
+#include <QByteArray>
+#include <QString>
+
+// Hex MD5 digests built on kovanserial's md5 implementation, so clients
+// and server agree on checksums byte for byte.
+namespace Md5Digest
+{
+	QByteArray data(const QByteArray &data);
+	
+	// Digest of the first length bytes of a file, or of all of it if
+	// length is negative. Returns an empty array if the file can't be read.
+	QByteArray file(const QString &path, const qint64 length = -1);
+}
+
+#endif
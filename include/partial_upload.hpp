@@ -0,0 +1,47 @@
+#ifndef _PARTIAL_UPLOAD_HPP_
+#define _PARTIAL_UPLOAD_HPP_
+
+#include <QString>
+#include <QByteArray>
+
+// An archive upload that may arrive in several chunks across
+// reconnects. Received bytes live in a part file named after the
+// expected digest and size; once the whole file is present and its MD5
+// matches, it is renamed over the destination in one step.
+class PartialUpload
+{
+public:
+	PartialUpload(const QString &dest = QString(), const QByteArray &md5 = QByteArray(),
+		const qint64 size = 0);
+	
+	// Digests become part of the part file's name, so only exactly 32 hex
+	// digits are accepted.
+	static bool isValidMd5(const QByteArray &md5);
+	
+	// Removes part files in dir that haven't been written to for a day,
+	// and part files for dest left over from a different md5 or size.
+	void removeAbandoned() const;
+	
+	qint64 size() const;
+	qint64 held() const;
+	QByteArray heldMd5() const;
+	bool isCommitted() const;
+	
+	// Appends a chunk that starts at offset. An offset of zero restarts the
+	// upload; any other offset must equal held(). The chunk is dropped if
+	// its MD5 doesn't match. Commits once the last byte arrives.
+	bool append(const qint64 offset, const QByteArray &chunk, const QByteArray &chunkMd5);
+	
+	// Whether append() could take a chunk at offset, checked before receiving it.
+	bool accepts(const qint64 offset) const;
+	
+private:
+	QString partPath() const;
+	bool commit();
+	
+	QString m_dest;
+	QByteArray m_md5;
+	qint64 m_size;
+};
+
+#endif
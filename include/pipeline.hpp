@@ -0,0 +1,75 @@
+#ifndef _PIPELINE_HPP_
+#define _PIPELINE_HPP_
+
+#include <QByteArray>
+#include <QString>
+#include <QQueue>
+#include <QSet>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+
+#include "compile_scheduler.hpp"
+
+// Requests a session accepted with COMMAND_ACTION_PIPE. Each one runs on
+// the pipeline's own pool and its response is queued as soon as it is
+// ready, so short requests are not held up behind long ones.
+class Pipeline
+{
+public:
+	struct Response
+	{
+		QByteArray id;
+		bool good;
+		QByteArray data;
+	};
+	
+	Pipeline();
+	~Pipeline();
+	
+	// False if the action can't be pipelined, too many are outstanding or
+	// id is already in use by an outstanding request.
+	bool submit(const QByteArray &id, const QString &action, const QString &dest);
+	
+	// Drops every outstanding request and cancels their compiles, e.g.
+	// when the client hangs up. Later submits start from a clean slate.
+	void cancelAll();
+	
+	// Requests submitted but not yet taken with next()
+	int outstanding() const;
+	
+	// The next finished request in completion order. Returns false if none
+	// finished within timeout ms.
+	bool next(Response &response, const unsigned long timeout);
+	
+	static bool isPipelined(const QString &action);
+	
+	// Runs one side-effect free action and returns the bytes the plain
+	// action would have sent. Also used by Session for the same actions.
+	static bool execute(const QString &action, const QString &dest, QByteArray &out);
+	
+private:
+	friend class PipelineTask;
+	
+	Pipeline(const Pipeline &);
+	Pipeline &operator =(const Pipeline &);
+	
+	bool isCurrent(const int generation) const;
+	// Compiles run here rather than in execute() so cancelAll() can reach them
+	bool compile(const int generation, const QString &dest, QByteArray &out);
+	void finished(const Response &response, const int generation);
+	
+	QThreadPool m_pool;
+	mutable QMutex m_mutex;
+	QWaitCondition m_ready;
+	QQueue<Response> m_done;
+	// Ids submitted and not yet taken with next()
+	QSet<QByteArray> m_ids;
+	QList<CompileWorkerPtr> m_workers;
+	// Bumped by cancelAll(); tasks from an older generation are discarded
+	int m_generation;
+	int m_outstanding;
+};
+
+#endif
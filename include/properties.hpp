@@ -2,10 +2,20 @@
 #define _PROPERTIES_HPP_
 
 #include <QMap>
+#include <QList>
+#include <QString>
+#include <QByteArray>
 #include <QMutex>
+#include <QWaitCondition>
 
-class QSettings;
+typedef QMap<QString, QString> PropertyMap;
 
+// Persistent key/value store. Readers copy the current snapshot under a
+// lock held only for that copy; QMap's implicit sharing makes the copy
+// O(1) and the copy stays valid however long the reader keeps it.
+// setValue() publishes a new snapshot and queues a journal line; a
+// background writer appends bursts of changes to the journal in one
+// write and folds the journal into the settings file once it grows.
 class Properties
 {
 public:
@@ -15,16 +25,28 @@ public:
 	QString value(const QString &property) const;
 	
 	static Properties *instance();
+	
 private:
-	void sync();
+	class Writer;
+	friend class Writer;
 	
 	Properties();
 	
-	QSettings settings() const;
+	void load();
+	void append(const QList<QByteArray> &lines);
+	void compact();
+	PropertyMap snapshot() const;
+	
+	// Only ever held to copy or replace m_snapshot
+	mutable QMutex m_snapshotMutex;
+	PropertyMap m_snapshot;
 	
-	QMap<QString, QString> m_properties;
+	// Guards everything below; only writers take it
 	QMutex m_mutex;
-	QSettings *m_settings;
+	QWaitCondition m_dirty;
+	QList<QByteArray> m_pending;
+	bool m_stop;
+	Writer *m_writer;
 };
 
 #endif
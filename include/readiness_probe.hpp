@@ -0,0 +1,38 @@
+#ifndef _READINESS_PROBE_HPP_
+#define _READINESS_PROBE_HPP_
+
+#include <QString>
+
+// Waits for input on a character device without consuming it.
+// The probe keeps its own descriptor on the device node; a tty's input
+// queue is shared between descriptors, so POLLIN on the probe means the
+// transmitter's next read will find bytes.
+class ReadinessProbe
+{
+public:
+	enum Result
+	{
+		Ready,
+		Idle,
+		Woken,
+		Failed
+	};
+
+	ReadinessProbe();
+	~ReadinessProbe();
+
+	bool open(const QString &path);
+	void close();
+	bool isOpen() const;
+
+	// Returns Woken when wakeFd becomes readable first.
+	Result wait(const int timeout, const int wakeFd = -1);
+
+private:
+	ReadinessProbe(const ReadinessProbe &);
+	ReadinessProbe &operator =(const ReadinessProbe &);
+
+	int m_fd;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _SCREEN_ENCODER_HPP_
+#define _SCREEN_ENCODER_HPP_
+
+#include <QByteArray>
+
+// Run-length encoding for RGB565 frames.
+//
+// An encoded frame is a 9 byte header followed by runs:
+//   "K565"  magic
+//   u16     width, little endian
+//   u16     height, little endian
+//   u8      flags; bit 0 set for a delta frame
+//   runs    (u16 count, u16 pixel) pairs, little endian
+//
+// A delta frame encodes the XOR of the current and previous frame, so
+// unchanged pixels collapse into long zero runs.
+class ScreenEncoder
+{
+public:
+	enum Flags
+	{
+		Delta = 1
+	};
+	
+	static QByteArray encode(const QByteArray &frame, const int width, const int height);
+	static QByteArray encodeDelta(const QByteArray &previous, const QByteArray &frame,
+		const int width, const int height);
+	
+private:
+	static QByteArray header(const int width, const int height, const quint8 flags);
+	static void appendRuns(QByteArray &out, const quint16 *pixels, const int count,
+		const quint16 *previous);
+};
+
+#endif
@@ -2,12 +2,82 @@
 #define _SERIAL_BRIDGE_HPP_
 
 #include <QObject>
+#include <QString>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QElapsedTimer>
 
+class QLocalSocket;
+class QTimer;
+
+// One launch request and, once botui answers, its result.
+class LaunchTicket
+{
+public:
+	LaunchTicket(const QString &path);
+	
+	const QString &path() const;
+	// Milliseconds since the launch was queued
+	qint64 age() const;
+	
+	// Blocks the calling thread for up to timeout ms. Returns false if
+	// botui has not answered by then.
+	bool wait(const int timeout, bool &launched);
+	
+	void finish(const bool launched);
+	
+	// A ticket nobody waits for any more is dropped if still queued
+	void abandon();
+	bool isAbandoned();
+	
+private:
+	QString m_path;
+	QElapsedTimer m_queued;
+	QMutex m_mutex;
+	QWaitCondition m_finished;
+	bool m_done;
+	bool m_launched;
+	bool m_abandoned;
+};
+
+typedef QSharedPointer<LaunchTicket> LaunchTicketPtr;
+
+// Asynchronous channel to botui's launcher. Launches are queued from any
+// thread and sent one at a time from the main thread without blocking
+// its event loop. botui's server reads one path, answers one byte and is
+// only known to handle a single request per connection, so every launch
+// gets its own connection, exactly like the old blocking client.
+// Constructed once in main() on the main thread; it must outlive every
+// server thread.
 class SerialBridge : public QObject
 {
 Q_OBJECT
-public slots:
-  bool run(const QString &path);
+public:
+	SerialBridge(QObject *parent = 0);
+	~SerialBridge();
+	
+	// Thread-safe. Every ticket is finished within LAUNCH_TIMEOUT_MS of this
+	// call, counting time spent queued; without a bridge it is already
+	// finished as failed.
+	static LaunchTicketPtr launch(const QString &path);
+	
+private slots:
+	void pump();
+	void connected();
+	void readAck();
+	void failed();
+	
+private:
+	void finishInFlight(const bool launched);
+	
+	QLocalSocket *m_socket;
+	QTimer *m_timeout;
+	
+	QMutex m_mutex;
+	QQueue<LaunchTicketPtr> m_pending;
+	LaunchTicketPtr m_inFlight;
 };
 
-#endif
\ No newline at end of file
+#endif
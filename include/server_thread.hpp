@@ -5,17 +5,20 @@
 #include <QString>
 #include <QThread>
 
-#include <kar/kar.hpp>
 #include <kovanserial/transport_layer.hpp>
 
+#include "readiness_probe.hpp"
+#include "device_monitor.hpp"
+
 class Transmitter;
 class KovanSerial;
+class Session;
 
 class ServerThread : public QThread
 {
 Q_OBJECT
 public:
-	ServerThread(Transmitter *transmitter);
+	ServerThread(Transmitter *transmitter, const QString &devicePath = QString());
 	~ServerThread();
 	
 	void stop();
@@ -28,20 +31,25 @@ public:
 	
 signals:
 	void stateChanged(const QString &state);
-	void run(const QString &executable);
 	
 protected:
 	bool handle(const Packet &p);
 	bool handleUntrusted(const Packet &p);
 	
 private:
-	void handleArchive(const Packet &headerPacket);
-	void handleAction(const Packet &action);
+	bool linkEvent();
+	bool isHealthy();
+	void attach();
+	void recover();
+	void waitForDevice(const int timeout);
 	
 	bool m_stop;
+	QString m_devicePath;
+	QString m_devName;
+	ReadinessProbe m_probe;
+	DeviceMonitor m_monitor;
 	Transmitter *m_transmitter;
-	TransportLayer *m_transport;
-	KovanSerial *m_proto;
+	Session *m_session;
 };
 
 #endif
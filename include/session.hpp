@@ -0,0 +1,85 @@
+#ifndef _SESSION_HPP_
+#define _SESSION_HPP_
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+#include <string>
+
+#include <kovanserial/transport_layer.hpp>
+#include <kovanserial/command_types.hpp>
+
+#include "compile_scheduler.hpp"
+#include "partial_upload.hpp"
+#include "stats.hpp"
+#include "pipeline.hpp"
+#include "serial_bridge.hpp"
+
+class Transmitter;
+class KovanSerial;
+
+// Protocol state for one connected client. Every USB link and every
+// accepted TCP connection gets its own Session, so clients never share
+// a transport or authentication state.
+class Session
+{
+public:
+	Session(Transmitter *transmitter, const Stats::Transport kind);
+	~Session();
+	
+	TransportLayer *transport() const;
+	KovanSerial *proto() const;
+	
+	bool handle(const Packet &p);
+	bool handleUntrusted(const Packet &p);
+	
+private:
+	Session(const Session &);
+	Session &operator =(const Session &);
+	
+	static bool isResume(const Packet &p);
+	static bool isCancel(const Packet &p);
+	// Whether a packet received mid-action may act on this session
+	bool isTrusted(const TransportLayer::Return ret) const;
+	void handleArchive(const Packet &headerPacket);
+	void handleArchiveChunk(const Command::FileHeaderData &header, const bool compressed);
+	void handleArchiveDelta(const Command::FileHeaderData &header, const bool compressed);
+	void handleAction(const Packet &action);
+	// Returns false if the client hung up while waiting.
+	bool waitForCompile(const CompileWorkerPtr &worker);
+	void sendDiagnostics(const CompileWorkerPtr &worker);
+	// Sends pipelined responses until none are outstanding. Returns false
+	// if the client hung up meanwhile.
+	bool collectPipeline();
+	// Returns false if the client hung up while botui was being asked.
+	bool waitForLaunch(const LaunchTicketPtr &ticket, bool &launched);
+	void handleScreenshot(const QString &mode);
+	// Waits out the gap between streamed frames while answering the
+	// client. Returns false if it cancelled the stream or hung up.
+	bool waitForNextFrame(const int ms);
+	
+	bool sendData(const std::string &dest, const std::string &metadata, const QByteArray &data);
+	// maxBytes caps the payload once inflated
+	bool recvData(const size_t size, QByteArray &out, const bool compressed, const qint64 maxBytes);
+	
+	Stats::Transport m_kind;
+	TransportLayer *m_transport;
+	KovanSerial *m_proto;
+	int m_configGeneration;
+	// Set by a redeemed session ticket; the client skips authentication
+	bool m_resumed;
+	bool m_compression;
+	// Set when a Hangup arrives inside a long-running action; handle()
+	// then ends the session once the action returns.
+	bool m_hungUp;
+	// Resumable uploads announced through COMMAND_ACTION_UPLOAD_STATUS
+	QMap<QString, PartialUpload> m_uploads;
+	// Requests accepted with COMMAND_ACTION_PIPE
+	Pipeline m_pipeline;
+	// Last frame sent to this client and its width, the base for delta screenshots
+	QByteArray m_lastFrame;
+	int m_lastFrameWidth;
+};
+
+#endif
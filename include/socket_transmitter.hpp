@@ -0,0 +1,29 @@
+#ifndef _SOCKET_TRANSMITTER_HPP_
+#define _SOCKET_TRANSMITTER_HPP_
+
+#include <kovanserial/transmitter.hpp>
+
+// Transmitter over an already connected stream socket. Takes ownership
+// of the descriptor and closes it in endSession().
+class SocketTransmitter : public Transmitter
+{
+public:
+	SocketTransmitter(const int fd);
+	~SocketTransmitter();
+	
+	virtual bool makeAvailable();
+	virtual void endSession();
+	
+	virtual ssize_t write(const uint8_t *data, const size_t &len);
+	virtual ssize_t read(uint8_t *data, const size_t &len);
+	
+	int fd() const;
+	
+private:
+	SocketTransmitter(const SocketTransmitter &);
+	SocketTransmitter &operator =(const SocketTransmitter &);
+	
+	int m_fd;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _STATS_HPP_
+#define _STATS_HPP_
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+
+#define STATS_MAX_COMMANDS 32
+#define STATS_MAX_ACTIONS 24
+#define STATS_BUCKETS 24
+
+// Latency histogram with power of two buckets in microseconds; bucket i
+// counts samples of at most 2^(i + 1) us, matching Prometheus' "le", and
+// the last bucket is open ended.
+// Updates are atomic increments, so recording never blocks. The sum is
+// in microseconds, kept as two 32-bit halves since QAtomicInt is 32-bit.
+class Histogram
+{
+public:
+	void record(const qint64 usecs);
+	
+	int count() const;
+	qint64 sum() const;
+	int bucket(const int i) const;
+	
+private:
+	QAtomicInt m_count;
+	QAtomicInt m_sumLow;
+	QAtomicInt m_sumHigh;
+	QAtomicInt m_buckets[STATS_BUCKETS];
+};
+
+// Process-wide counters for the serial server, split by transport.
+// Byte counters are 32-bit and wrap, like SNMP Counter32.
+class Stats
+{
+public:
+	enum Transport
+	{
+		Usb = 0,
+		Tcp,
+		TransportCount
+	};
+	
+	void recordCommand(const Transport transport, const int type, const qint64 usecs);
+	void recordAction(const Transport transport, const QString &action, const qint64 usecs);
+	void addBytesIn(const Transport transport, const int bytes);
+	void addBytesOut(const Transport transport, const int bytes);
+	void recordUsbRecovery(const qint64 usecs);
+	
+	// Prometheus text exposition of every counter and histogram.
+	QByteArray toText() const;
+	
+	static Stats *instance();
+	
+private:
+	Stats();
+	
+	static int actionIndex(const QString &action);
+	static const char *transportName(const int transport);
+	
+	Histogram m_commands[TransportCount][STATS_MAX_COMMANDS];
+	Histogram m_actions[TransportCount][STATS_MAX_ACTIONS];
+	QAtomicInt m_bytesIn[TransportCount];
+	QAtomicInt m_bytesOut[TransportCount];
+	Histogram m_usbRecoveries;
+};
+
+#endif
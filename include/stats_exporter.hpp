@@ -0,0 +1,21 @@
+#ifndef _STATS_EXPORTER_HPP_
+#define _STATS_EXPORTER_HPP_
+
+#include <QObject>
+#include <QString>
+
+// Serves Stats on the system bus as org.kipr.Serial.Stats at /org/kipr/Serial.
+class StatsExporter : public QObject
+{
+Q_OBJECT
+Q_CLASSINFO("D-Bus Interface", "org.kipr.Serial")
+public:
+	StatsExporter(QObject *parent = 0);
+	
+	bool registerOnBus();
+	
+public slots:
+	Q_SCRIPTABLE QString Stats() const;
+};
+
+#endif
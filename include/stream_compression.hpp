@@ -0,0 +1,25 @@
+#ifndef _STREAM_COMPRESSION_HPP_
+#define _STREAM_COMPRESSION_HPP_
+
+#include <QByteArray>
+
+// Block-framed compression for file payloads on negotiated sessions.
+// The payload is split into STREAM_COMPRESSION_BLOCK sized blocks. Each
+// block is written as a QDataStream QByteArray holding qCompress output
+// at the fastest level, and an empty QByteArray ends the stream. Blocks
+// let a receiver inflate incrementally and keep worst-case expansion to
+// a few bytes per block.
+namespace StreamCompression
+{
+	// Suffix appended to a file's metadata when its payload is compressed
+	extern const char *const suffix;
+	
+	bool isSupported(const QByteArray &codec);
+	
+	QByteArray compress(const QByteArray &data);
+	// Fails as soon as the output would exceed maxBytes; each block must
+	// also inflate to exactly the size its header declares.
+	bool decompress(const QByteArray &data, QByteArray &out, const qint64 maxBytes);
+}
+
+#endif
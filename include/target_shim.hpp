@@ -0,0 +1,40 @@
+#ifndef _TARGET_SHIM_HPP_
+#define _TARGET_SHIM_HPP_
+
+#include <QString>
+
+#include <pcompiler/options.hpp>
+#include <pcompiler/output.hpp>
+
+// The rc/target.c runtime shim linked into every C/C++ project. It is
+// compiled once per toolchain fingerprint and resource contents and the
+// object is shared by all builds, instead of being recompiled with each.
+class TargetShim
+{
+public:
+	// Holds the shim object for these options, built on first use, until
+	// destroyed; objects in use are never cleaned up under a link.
+	class Use
+	{
+	public:
+		Use(const Compiler::Options &options, Compiler::Output &failure);
+		~Use();
+		
+		// Empty on failure, with the compiler's output in failure.
+		const QString &object() const;
+		
+	private:
+		Use(const Use &);
+		Use &operator =(const Use &);
+		
+		QString m_object;
+	};
+	
+private:
+	static QString acquire(const Compiler::Options &options, Compiler::Output &failure);
+	static void release(const QString &object);
+	static void removeStale(const QString &dir, const QString &current);
+	static QString key(const Compiler::Options &options, const QByteArray &source);
+};
+
+#endif
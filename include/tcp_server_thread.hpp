@@ -3,14 +3,29 @@
 
 #include "server_thread.hpp"
 
-class TcpServer;
+#include <QThreadPool>
+#include <QAtomicInt>
 
+// Accepts TCP clients and serves each connection with its own Session on
+// its own pool thread. Connections beyond maxSessions are refused.
 class TcpServerThread : public ServerThread
 {
 public:
-	TcpServerThread(TcpServer *transmitter);
+	TcpServerThread(const quint16 port, const int maxSessions);
+	~TcpServerThread();
+	
+	bool listen();
 	
 	virtual void run();
+	
+private:
+	friend class TcpSessionTask;
+	
+	quint16 m_port;
+	int m_fd;
+	int m_maxSessions;
+	QAtomicInt m_sessions;
+	QThreadPool m_pool;
 };
 
 #endif
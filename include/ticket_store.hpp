@@ -0,0 +1,43 @@
+#ifndef _TICKET_STORE_HPP_
+#define _TICKET_STORE_HPP_
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+// Short-lived, single-use session tickets. An authenticated client asks
+// for one and presents it on its next connection to skip the password
+// handshake; a resumed session asks for a fresh one to chain. Tickets
+// expire after SESSION_TICKET_TTL_MS and are void as soon as the
+// password differs from the one they were issued under.
+class TicketStore
+{
+public:
+	// 32 hex characters from /dev/urandom; empty if no randomness is
+	// available or the device config can't be read
+	QByteArray issue();
+	// Consumes the ticket whether or not it is still valid
+	bool redeem(const QByteArray &ticket);
+	
+	static TicketStore *instance();
+	
+private:
+	TicketStore();
+	
+	struct Entry
+	{
+		qint64 expires;
+		QByteArray credential;
+	};
+	
+	// Digest of the current password settings; empty if they are unknown
+	static QByteArray credential();
+	void purge(const qint64 now);
+	
+	QMutex m_mutex;
+	QElapsedTimer m_clock;
+	QHash<QByteArray, Entry> m_tickets;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _UNIT_COMPILER_HPP_
+#define _UNIT_COMPILER_HPP_
+
+#include <QString>
+#include <QStringList>
+
+#include <pcompiler/options.hpp>
+#include <pcompiler/output.hpp>
+
+// Compiles single C/C++ translation units to objects with the toolchain
+// and flags from the platform hints. Dependency files written alongside
+// each object let isStale() skip units whose sources and headers are
+// unchanged.
+class UnitCompiler
+{
+public:
+	// Receives each line of compiler stderr as soon as it is written.
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		virtual void line(const QString &source, const QByteArray &line) = 0;
+	};
+	
+	UnitCompiler(const Compiler::Options &options, const QString &includePath);
+	
+	static bool isUnit(const QString &file);
+	
+	// Changes whenever the compilers or flags do; objects built under a
+	// different fingerprint must not be reused.
+	QString fingerprint() const;
+	
+	bool isStale(const QString &source, const QString &object) const;
+	Compiler::Output compile(const QString &source, const QString &object,
+		Listener *listener = 0) const;
+	
+	// Diagnostics recorded when an up-to-date object was last built.
+	Compiler::Output replay(const QString &source, const QString &object) const;
+	
+private:
+	static bool isCpp(const QString &file);
+	static QStringList parseDeps(const QString &rules);
+	QStringList arguments(const QString &source, const QString &object) const;
+	
+	QString m_cc;
+	QString m_cxx;
+	QStringList m_cFlags;
+	QStringList m_cppFlags;
+	QString m_includePath;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "batch_read.hpp"
+#include "constants.hpp"
+#include "mapped_file.hpp"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+
+#include <glob.h>
+
+// Most paths one request may name, and the most file data one bundle carries
+#define BATCH_MAX_FILES 1024
+#define BATCH_MAX_BYTES (16 * 1024 * 1024)
+
+bool BatchRead::build(const QString &request, QByteArray &out)
+{
+	bool truncated = false;
+	const QStringList paths = expand(request, truncated);
+	if(paths.isEmpty()) return false;
+	
+	out.clear();
+	QDataStream stream(&out, QIODevice::WriteOnly);
+	stream << quint32(paths.size() + (truncated ? 1 : 0));
+	
+	qint64 budget = BATCH_MAX_BYTES;
+	foreach(const QString &path, paths) {
+		quint8 status = Ok;
+		MappedFile file;
+		if(!isUnderRoot(path)) status = OutsideRoot;
+		else if(!QFileInfo(path).isFile() || !file.open(path)) status = Unreadable;
+		else if(qint64(file.size()) > budget) status = TooLarge;
+		
+		// Copied before the status goes out, so a file that shrinks mid-read is reported
+		QByteArray contents;
+		if(status == Ok) contents = QByteArray(file.data(), file.size());
+		if(file.isTruncated()) status = Unreadable;
+		
+		stream << path.toUtf8() << status;
+		if(status != Ok) {
+			stream << QByteArray();
+			continue;
+		}
+		budget -= file.size();
+		stream << contents;
+	}
+	
+	if(truncated) {
+		stream << request.section('\n', 0, 0).toUtf8() << quint8(Truncated) << QByteArray();
+	}
+	return stream.status() == QDataStream::Ok;
+}
+
+QStringList BatchRead::expand(const QString &request, bool &truncated)
+{
+	const QRegExp wildcards("[*?\\[]");
+	QStringList paths = request.split('\n', QString::SkipEmptyParts);
+	if(paths.size() != 1 || !paths[0].contains(wildcards)) {
+		truncated = paths.size() > BATCH_MAX_FILES;
+		return paths.mid(0, BATCH_MAX_FILES);
+	}
+	
+	// A single pattern. A literal directory part is resolved first, so
+	// "/kovan/../etc/*" is refused before glob() ever lists /etc.
+	const QString pattern = paths[0];
+	paths.clear();
+	const QString dir = QFileInfo(pattern).path();
+	if(!dir.contains(wildcards) && !isUnderRoot(dir) && QFileInfo(dir).canonicalFilePath() != root()) {
+		return QStringList() << pattern;
+	}
+	
+	// Matches outside the root are dropped, not reported, so a pattern
+	// can't be used to probe for files elsewhere
+	glob_t matches;
+	if(glob(QFile::encodeName(pattern).constData(), 0, 0, &matches) == 0) {
+		for(size_t i = 0; i < matches.gl_pathc; ++i) {
+			const QString match = QFile::decodeName(matches.gl_pathv[i]);
+			if(!isUnderRoot(match)) continue;
+			if(paths.size() == BATCH_MAX_FILES) {
+				truncated = true;
+				break;
+			}
+			paths << match;
+		}
+	}
+	globfree(&matches);
+	return paths;
+}
+
+bool BatchRead::isUnderRoot(const QString &path)
+{
+	// Resolves symlinks and "..", so neither can escape the root
+	const QString canonical = QFileInfo(path).canonicalFilePath();
+	const QString base = root();
+	return !canonical.isEmpty() && !base.isEmpty() && canonical.startsWith(base + "/");
+}
+
+QString BatchRead::root()
+{
+	// USER_ROOT may itself be a symlink, e.g. onto the SD card
+	return QFileInfo(USER_ROOT).canonicalFilePath();
+}
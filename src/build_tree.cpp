@@ -0,0 +1,165 @@
+#include "build_tree.hpp"
+#include "constants.hpp"
+#include "file_utils.hpp"
+
+#include <QMutex>
+#include <QMap>
+#include <QFileInfo>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include <sys/types.h>
+#include <utime.h>
+
+#define FINGERPRINT_FILE ".fingerprint"
+
+namespace
+{
+	struct LockEntry
+	{
+		QMutex mutex;
+		int users;
+	};
+	
+	QMutex s_registryMutex;
+	QMap<QString, LockEntry *> s_locks;
+}
+
+BuildTree::Lock::Lock(const BuildTree &tree)
+	: m_path(tree.m_path)
+{
+	s_registryMutex.lock();
+	LockEntry *&entry = s_locks[m_path];
+	if(!entry) {
+		entry = new LockEntry;
+		entry->users = 0;
+	}
+	++entry->users;
+	LockEntry *held = entry;
+	s_registryMutex.unlock();
+	
+	held->mutex.lock();
+}
+
+BuildTree::Lock::~Lock()
+{
+	QMutexLocker locker(&s_registryMutex);
+	LockEntry *entry = s_locks.value(m_path);
+	entry->mutex.unlock();
+	if(--entry->users > 0) return;
+	s_locks.remove(m_path);
+	delete entry;
+}
+
+BuildTree::BuildTree(const QString &name)
+	: m_path(QString(BUILD_ROOT) + "/" + name)
+{
+}
+
+bool BuildTree::isValidName(const QString &name)
+{
+	return !name.isEmpty() && name != "." && name != ".."
+		&& !name.contains('/') && !name.contains(QChar(0));
+}
+
+QString BuildTree::sourcePath() const
+{
+	return m_path + "/src";
+}
+
+QString BuildTree::objectPath() const
+{
+	return m_path + "/obj";
+}
+
+QString BuildTree::objectFor(const QString &source) const
+{
+	return objectPath() + "/" + QDir(sourcePath()).relativeFilePath(source) + ".o";
+}
+
+bool BuildTree::sync(const kiss::KarPtr &archive, QStringList &files)
+{
+	const QString root = sourcePath();
+	QSet<QString> keep;
+	int written = 0;
+	
+	foreach(const QString &file, archive->files()) {
+		const QString path = QDir::cleanPath(QFileInfo(root + "/" + file).absoluteFilePath());
+		if(!path.startsWith(root + "/")) {
+			qWarning() << "Refusing archive path" << file;
+			return false;
+		}
+		keep << path;
+		files << path;
+		
+		const QByteArray data = archive->data(file);
+		if(sameContents(path, data)) continue;
+		
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile out(path);
+		if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate)
+			|| out.write(data) != data.size()) {
+			qWarning() << "Failed to write" << path;
+			return false;
+		}
+		++written;
+	}
+	
+	removeStale(root, keep);
+	// The tree's mtime records its last build for evict()
+	utime(QFile::encodeName(m_path).constData(), 0);
+	qDebug() << "Synced" << m_path << "-" << written << "of" << files.size() << "files changed";
+	return true;
+}
+
+void BuildTree::setFingerprint(const QString &fingerprint)
+{
+	QFile file(objectPath() + "/" FINGERPRINT_FILE);
+	if(file.open(QIODevice::ReadOnly) && file.readAll() == fingerprint.toUtf8()) return;
+	file.close();
+	
+	FileUtils::removeRecursively(objectPath());
+	QDir().mkpath(objectPath());
+	if(file.open(QIODevice::WriteOnly)) file.write(fingerprint.toUtf8());
+}
+
+void BuildTree::evict()
+{
+	QFileInfoList trees = QDir(BUILD_ROOT).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time);
+	
+	// Newest first; keep trees until the budget runs out. The registry
+	// mutex is held while removing, so nobody can lock a tree mid-removal.
+	qint64 total = 0;
+	foreach(const QFileInfo &tree, trees) {
+		const QString path = tree.absoluteFilePath();
+		if(!isValidName(tree.fileName()) || tree.fileName().startsWith('.')) continue;
+		total += FileUtils::diskUsage(path);
+		if(total <= BUILD_ROOT_MAX_BYTES) continue;
+		
+		QMutexLocker locker(&s_registryMutex);
+		if(s_locks.contains(path)) continue;
+		qDebug() << "Evicting build tree" << path;
+		FileUtils::removeRecursively(path);
+	}
+}
+
+bool BuildTree::sameContents(const QString &path, const QByteArray &data)
+{
+	QFile file(path);
+	if(file.size() != data.size() || !file.open(QIODevice::ReadOnly)) return false;
+	return file.readAll() == data;
+}
+
+void BuildTree::removeStale(const QString &dir, const QSet<QString> &keep)
+{
+	QFileInfoList entries = QDir(dir).entryInfoList(QDir::NoDotAndDotDot | QDir::System
+		| QDir::Hidden | QDir::AllDirs | QDir::Files);
+	foreach(const QFileInfo &entry, entries) {
+		const QString path = entry.absoluteFilePath();
+		if(entry.isDir()) {
+			removeStale(path, keep);
+			QDir().rmdir(path);
+		} else if(!keep.contains(path)) QFile::remove(path);
+	}
+}
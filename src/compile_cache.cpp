@@ -0,0 +1,194 @@
+#include "compile_cache.hpp"
+#include "constants.hpp"
+#include "file_utils.hpp"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include <sys/types.h>
+#include <utime.h>
+
+#define OUTPUT_FILE "output.col"
+#define BIN_DIR "bin"
+
+static bool hashFile(QCryptographicHash &hash, const QString &path)
+{
+	QFile file(path);
+	if(!file.open(QIODevice::ReadOnly)) return false;
+	while(!file.atEnd()) hash.addData(file.read(64 * 1024));
+	return true;
+}
+
+QString CompileCache::key(const QString &archivePath, const QString &name)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	if(!hashFile(hash, archivePath)) return QString();
+	hashFile(hash, PLATFORM_HINTS);
+	hashFile(hash, ":/target.c");
+	hash.addData(name.toUtf8());
+	return hash.result().toHex();
+}
+
+bool CompileCache::lookup(const QString &key, const QString &name, Compiler::OutputList &output)
+{
+	if(key.isEmpty()) {
+		m_misses.ref();
+		return false;
+	}
+	
+	// Readers only copy out of entries, so any number may run at once
+	QReadLocker locker(&m_lock);
+	const QString entry = entryPath(key);
+	
+	QFile file(entry + "/" OUTPUT_FILE);
+	if(!file.open(QIODevice::ReadOnly)) {
+		m_misses.ref();
+		return false;
+	}
+	
+	Compiler::OutputList cached;
+	QDataStream stream(&file);
+	stream >> cached;
+	file.close();
+	
+	// Restore into a staging copy first; the installed binary is only
+	// replaced once the entry has proven usable. Callers hold the
+	// project's BuildTree::Lock; the staging name is unique regardless.
+	const QString bin = binPath(name);
+	const QString staging = bin + QString(".cached%1").arg(m_staging.fetchAndAddRelaxed(1));
+	FileUtils::removeRecursively(staging);
+	if(stream.status() != QDataStream::Ok || !QFileInfo(entry + "/" BIN_DIR).isDir()
+		|| !FileUtils::copyRecursively(entry + "/" BIN_DIR, staging)) {
+		qWarning() << "Ignoring unusable compile cache entry" << key;
+		FileUtils::removeRecursively(staging);
+		m_misses.ref();
+		return false;
+	}
+	
+	FileUtils::removeRecursively(bin);
+	if(!QDir().rename(staging, bin)) {
+		FileUtils::removeRecursively(staging);
+		m_misses.ref();
+		return false;
+	}
+	
+	// The entry's mtime records its last use for eviction
+	utime(QFile::encodeName(entry).constData(), 0);
+	
+	output = cached;
+	m_hits.ref();
+	return true;
+}
+
+void CompileCache::store(const QString &key, const QString &name, const Compiler::OutputList &output)
+{
+	if(key.isEmpty() || !isCacheable(output)) return;
+	
+	// Called under the project's BuildTree::Lock, so bin/<name> is not being
+	// installed meanwhile. Built without m_lock; concurrent stores get
+	// their own staging dirs.
+	const QString entry = entryPath(key);
+	const QString staging = entry + QString(".tmp%1").arg(m_staging.fetchAndAddRelaxed(1));
+	FileUtils::removeRecursively(staging);
+	if(!QDir().mkpath(staging)) return;
+	
+	QFile file(staging + "/" OUTPUT_FILE);
+	bool good = file.open(QIODevice::WriteOnly);
+	if(good) {
+		QDataStream stream(&file);
+		stream << output;
+		file.close();
+		good = stream.status() == QDataStream::Ok;
+	}
+	
+	good = good && FileUtils::copyRecursively(binPath(name), staging + "/" BIN_DIR);
+	
+	// Publish the entry in one rename so lookups never see it half written
+	QWriteLocker locker(&m_lock);
+	FileUtils::removeRecursively(entry);
+	if(!good || !QDir().rename(staging, entry)) {
+		qWarning() << "Failed to store compile cache entry" << key;
+		FileUtils::removeRecursively(staging);
+		return;
+	}
+	
+	evict();
+}
+
+bool CompileCache::isCacheable(const Compiler::OutputList &output)
+{
+	// Only bin/<name> is cached. Libraries and headers are installed
+	// elsewhere and are shared with dependent projects, so a hit could not
+	// restore them.
+	foreach(const Compiler::Output &o, output) {
+		if(o.terminal() == Compiler::Output::LibraryTerminal
+			|| o.terminal() == Compiler::Output::HeaderTerminal) return false;
+	}
+	return true;
+}
+
+int CompileCache::hits() const
+{
+	return m_hits;
+}
+
+int CompileCache::misses() const
+{
+	return m_misses;
+}
+
+CompileCache *CompileCache::instance()
+{
+	static CompileCache s_instance;
+	return &s_instance;
+}
+
+CompileCache::CompileCache()
+	: m_root(COMPILE_CACHE_ROOT),
+	m_hits(0),
+	m_misses(0),
+	m_staging(0)
+{
+	QDir().mkpath(m_root);
+	
+	// Drop staging dirs left behind by an interrupted store
+	foreach(const QString &staging, QDir(m_root).entryList(QStringList() << "*.tmp*", QDir::Dirs)) {
+		FileUtils::removeRecursively(m_root + "/" + staging);
+	}
+	// and restores interrupted before their rename
+	const QString bins = binPath(QString());
+	foreach(const QString &staging, QDir(bins).entryList(QStringList() << "*.cached*", QDir::Dirs)) {
+		FileUtils::removeRecursively(bins + staging);
+	}
+}
+
+QString CompileCache::entryPath(const QString &key) const
+{
+	return m_root + "/" + key;
+}
+
+QString CompileCache::binPath(const QString &name)
+{
+	return QString::fromStdString(USER_ROOT) + "/bin/" + name;
+}
+
+void CompileCache::evict()
+{
+	QFileInfoList entries = QDir(m_root).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time);
+	
+	// Newest first; keep entries until the budget runs out.
+	qint64 total = 0;
+	foreach(const QFileInfo &entry, entries) {
+		// Staging dirs of stores still in progress
+		if(entry.fileName().contains(".tmp")) continue;
+		total += FileUtils::diskUsage(entry.absoluteFilePath());
+		if(total <= COMPILE_CACHE_MAX_BYTES) continue;
+		qDebug() << "Evicting compile cache entry" << entry.fileName();
+		FileUtils::removeRecursively(entry.absoluteFilePath());
+	}
+}
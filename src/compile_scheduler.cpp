@@ -0,0 +1,76 @@
+#include "compile_scheduler.hpp"
+#include "compile_worker.hpp"
+
+#include <QRunnable>
+#include <QThread>
+
+class CompileTask : public QRunnable
+{
+public:
+	CompileTask(const CompileWorkerPtr &worker, CompileScheduler *scheduler)
+		: m_worker(worker),
+		m_scheduler(scheduler)
+	{
+	}
+	
+	void run()
+	{
+		m_worker->run();
+		m_scheduler->finished(m_worker);
+	}
+	
+private:
+	CompileWorkerPtr m_worker;
+	CompileScheduler *m_scheduler;
+};
+
+CompileScheduler::~CompileScheduler()
+{
+	QMutexLocker locker(&m_mutex);
+	foreach(const CompileWorkerPtr &worker, m_active) worker->cancel();
+	locker.unlock();
+	m_pool.waitForDone();
+}
+
+void CompileScheduler::enqueue(const CompileWorkerPtr &worker)
+{
+	QMutexLocker locker(&m_mutex);
+	m_active.append(worker);
+	locker.unlock();
+	
+	m_pool.start(new CompileTask(worker, this));
+}
+
+bool CompileScheduler::cancel(const QString &name)
+{
+	bool found = false;
+	QMutexLocker locker(&m_mutex);
+	foreach(const CompileWorkerPtr &worker, m_active) {
+		if(worker->name() != name) continue;
+		worker->cancel();
+		found = true;
+	}
+	return found;
+}
+
+int CompileScheduler::maxConcurrent() const
+{
+	return m_pool.maxThreadCount();
+}
+
+CompileScheduler *CompileScheduler::instance()
+{
+	static CompileScheduler s_instance;
+	return &s_instance;
+}
+
+CompileScheduler::CompileScheduler()
+{
+	m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+void CompileScheduler::finished(const CompileWorkerPtr &worker)
+{
+	QMutexLocker locker(&m_mutex);
+	m_active.removeAll(worker);
+}
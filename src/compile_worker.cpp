@@ -1,70 +1,149 @@
 #include "compile_worker.hpp"
 #include "constants.hpp"
+#include "compile_cache.hpp"
+#include "build_tree.hpp"
+#include "unit_compiler.hpp"
+#include "target_shim.hpp"
 
-#include <kovanserial/kovan_serial.hpp>
 #include <pcompiler/pcompiler.hpp>
 #include <pcompiler/root_manager.hpp>
 
 #include <QFileInfo>
 #include <QDir>
-#include <QDateTime>
+#include <QFile>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <QVector>
+#include <QSemaphore>
+#include <QScopedPointer>
 #include <QDebug>
 
-struct Cleaner
+// platform.hints key for how many units one job compiles at once;
+// defaults to the number of cores
+#define PARALLEL_JOBS_KEY "PARALLEL_JOBS"
+
+// Compiler processes running across all jobs. CompileScheduler already runs
+// a job per core, so each unit takes a slot from this one budget rather than
+// every job starting its own core-count of compilers.
+static QSemaphore s_unitSlots(qMax(1, QThread::idealThreadCount()));
+
+// Compiles or replays one translation unit for CompileWorker::compile()
+class UnitTask : public QRunnable
 {
 public:
-	Cleaner(const QString& path)
-		: path(path)
+	UnitTask(CompileWorker *worker, const UnitCompiler *units, const QString &source,
+		const QString &object, Compiler::Output *result, QAtomicInt *completed, const int total)
+		: m_worker(worker),
+		m_units(units),
+		m_source(source),
+		m_object(object),
+		m_result(result),
+		m_completed(completed),
+		m_total(total)
 	{
 	}
-
-	~Cleaner()
-	{
-		remove(path);
-	}
-
-private:
-	bool remove(const QString& path)
+	
+	void run()
 	{
-		QDir dir(path);
-
-		if(!dir.exists()) return true;
-
-		QFileInfoList entries = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::System | QDir::Hidden
-			| QDir::AllDirs | QDir::Files, QDir::DirsFirst);
-
-		foreach(const QFileInfo& entry, entries) {
-			const QString entryPath = entry.absoluteFilePath();
-			if(!(entry.isDir() ? remove(entryPath) : QFile::remove(entryPath))) return false;
+		if(m_worker->isCancelled()) {
+			*m_result = Compiler::Output(m_source, 1, QByteArray(), "error: compile cancelled");
+		} else if(m_units->isStale(m_source, m_object)) {
+			s_unitSlots.acquire();
+			*m_result = m_units->compile(m_source, m_object, m_worker);
+			s_unitSlots.release();
+			m_worker->post(*m_result);
+		} else {
+			*m_result = m_units->replay(m_source, m_object);
+			m_worker->post(*m_result);
 		}
-
-		if(!dir.rmdir(path)) return false;
-
-		return true;
+		
+		// Units finish in any order; report how many are done, not which
+		const int completed = m_completed->fetchAndAddOrdered(1) + 1;
+		m_worker->progress(double(completed) / m_total);
 	}
-
-	QString path;
+	
+private:
+	CompileWorker *m_worker;
+	const UnitCompiler *m_units;
+	QString m_source;
+	QString m_object;
+	Compiler::Output *m_result;
+	QAtomicInt *m_completed;
+	int m_total;
 };
 
-CompileWorker::CompileWorker(const kiss::KarPtr &archive, KovanSerial *proto, QObject *parent)
-	: QThread(parent),
-	m_archive(archive),
-	m_proto(proto)
+CompileWorker::CompileWorker(const kiss::KarPtr &archive)
+	: m_archive(archive),
+	m_streaming(false),
+	m_targetShim(false),
+	m_state(Queued),
+	m_cancelRequested(false),
+	m_fraction(0.0),
+	m_stageBase(0.0),
+	m_stageSpan(1.0)
+{
+}
+
+CompileWorkerPtr CompileWorker::forProject(const QString &name)
 {
+	// The name also becomes a path under BUILD_ROOT and USER_ROOT/bin
+	if(!BuildTree::isValidName(name)) return CompileWorkerPtr();
+	
+	Compiler::RootManager root(USER_ROOT);
+	const QString archivePath = root.archivesPath(name);
+	kiss::KarPtr archive = kiss::Kar::load(archivePath);
+	if(archive.isNull()) return CompileWorkerPtr();
+	
+	const QStringList cExts = QStringList() << "c" << "cpp" << "cxx" << "cc";
+	bool isCProj = false;
+	Q_FOREACH(const QString &file, archive->files()) {
+		QFileInfo info(file);
+		isCProj |= (bool)cExts.contains(info.completeSuffix(), Qt::CaseInsensitive);
+	}
+	
+	CompileWorkerPtr worker(new CompileWorker(archive));
+	worker->setTargetShim(isCProj);
+	worker->setName(name);
+	worker->setCacheKey(CompileCache::key(archivePath, name));
+	return worker;
 }
 
 void CompileWorker::run()
 {
-	m_output = compile();
+	if(isCancelled()) {
+		setState(Cancelled);
+		return;
+	}
+	
+	setState(Running);
 	
-	qDebug() << "Sending finish!";
-	if(!m_proto || !m_proto->sendFileActionProgress(1.0, true)) {
-		qWarning() << "send terminal file action progress failed.";
+	Compiler::OutputList output;
+	if(!BuildTree::isValidName(m_name)) {
+		output << Compiler::Output(m_name, 1, QByteArray(), "error: invalid project name");
+	} else {
+		// The cache restores into and copies out of USER_ROOT/bin/<name>,
+		// so it runs under the same per-project lock as the build and install
+		BuildTree tree(m_name);
+		BuildTree::Lock buildLock(tree);
+		CompileCache *cache = CompileCache::instance();
+		if(!cache->lookup(m_cacheKey, m_name, output)) {
+			output = compile(tree);
+			if(!isCancelled() && isSuccess(output)) cache->store(m_cacheKey, m_name, output);
+			BuildTree::evict();
+		} else post(output);
 	}
+	
+	QMutexLocker locker(&m_mutex);
+	if(!m_streaming) m_output = output;
+	m_state = m_cancelRequested ? Cancelled : Finished;
+	m_done.wakeAll();
 }
 
-const Compiler::OutputList &CompileWorker::output() const
+Compiler::OutputList CompileWorker::output() const
 {
+	QMutexLocker locker(&m_mutex);
 	return m_output;
 }
 
@@ -78,50 +157,206 @@ const QString &CompileWorker::name() const
 	return m_name;
 }
 
+void CompileWorker::setTargetShim(const bool targetShim)
+{
+	m_targetShim = targetShim;
+}
+
+bool CompileWorker::hasTargetShim() const
+{
+	return m_targetShim;
+}
+
+void CompileWorker::setCacheKey(const QString &cacheKey)
+{
+	m_cacheKey = cacheKey;
+}
+
+const QString &CompileWorker::cacheKey() const
+{
+	return m_cacheKey;
+}
+
+void CompileWorker::setStreaming(const bool streaming)
+{
+	m_streaming = streaming;
+}
+
+bool CompileWorker::isStreaming() const
+{
+	return m_streaming;
+}
+
+QList<CompileWorker::Diagnostic> CompileWorker::takeDiagnostics()
+{
+	QMutexLocker locker(&m_mutex);
+	QList<Diagnostic> ret = m_diagnostics;
+	m_diagnostics.clear();
+	return ret;
+}
+
 void CompileWorker::progress(double fraction)
 {
 	//qDebug() << "Progress..." << fraction;
-	if(!m_proto || !m_proto->sendFileActionProgress(false, fraction)) {
-		qWarning() << "send file action progress failed.";
-	}
+	QMutexLocker locker(&m_mutex);
+	// Stages report their own 0..1 fraction; keep the overall value monotonic
+	m_fraction = qMax(m_fraction, m_stageBase + fraction * m_stageSpan);
 }
 
-Compiler::OutputList CompileWorker::compile()
+double CompileWorker::fraction() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_fraction;
+}
+
+void CompileWorker::line(const QString &source, const QByteArray &line)
+{
+	if(!m_streaming) return;
+	
+	Diagnostic diagnostic;
+	diagnostic.metadata = "cl";
+	QDataStream stream(&diagnostic.data, QIODevice::WriteOnly);
+	stream << source << line;
+	
+	QMutexLocker locker(&m_mutex);
+	m_diagnostics.append(diagnostic);
+}
+
+CompileWorker::State CompileWorker::state() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_state;
+}
+
+void CompileWorker::cancel()
+{
+	QMutexLocker locker(&m_mutex);
+	m_cancelRequested = true;
+}
+
+bool CompileWorker::isCancelled() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_cancelRequested;
+}
+
+bool CompileWorker::wait(const unsigned long timeout)
+{
+	QMutexLocker locker(&m_mutex);
+	if(m_state != Finished && m_state != Cancelled) m_done.wait(&m_mutex, timeout);
+	return m_state == Finished || m_state == Cancelled;
+}
+
+void CompileWorker::setState(const State state)
+{
+	QMutexLocker locker(&m_mutex);
+	m_state = state;
+	if(state == Finished || state == Cancelled) m_done.wakeAll();
+}
+
+Compiler::OutputList CompileWorker::compile(BuildTree &tree)
 {
 	using namespace Compiler;
 	using namespace kiss;
 
-	// Extract the archive to a temporary directory
-	QString path = tempPath();
-	Cleaner cleaner(path);
-	if(!m_archive->extract(path)) {
-		return OutputList() << Output(path, 1,
+	// Sync the archive into the project's persistent build tree; the
+	// caller holds its lock
+	QStringList files;
+	if(!tree.sync(m_archive, files)) {
+		return OutputList() << Output(tree.sourcePath(), 1,
 			QByteArray(), "error: failed to extract KISS Archive");
 	}
 	
-	QStringList extracted;
-	foreach(const QString &file, m_archive->files()) extracted << path
-		+ "/" + file;
-	qDebug() << "Extracted" << extracted;
-
-	// Invoke pcompiler on the extracted files
-	Engine engine(Compilers::instance()->compilers());
-	Options opts = Options::load("/etc/kovan/platform.hints");
+	Options opts = Options::load(PLATFORM_HINTS);
 	opts.setVariable("${USER_ROOT}", USER_ROOT);
 	
-	Compiler::OutputList ret = engine.compile(Input::fromList(extracted), opts, this);
+	UnitCompiler units(opts, tree.sourcePath());
+	tree.setFingerprint(units.fingerprint());
+	
+	QStringList sources;
+	QStringList inputs;
+	foreach(const QString &file, files) {
+		if(UnitCompiler::isUnit(file)) sources << file;
+		else inputs << file;
+	}
+	
+	// Build only the objects whose sources or headers changed, fanned out
+	// across a pool; the link waits for every unit.
+	const int jobs = opts.value(PARALLEL_JOBS_KEY).toInt();
+	QThreadPool pool;
+	pool.setMaxThreadCount(jobs > 0 ? jobs : QThread::idealThreadCount());
+	
+	QVector<Output> results(sources.size());
+	QAtomicInt completed(0);
+	setStage(0.0, sources.isEmpty() ? 0.0 : 0.5);
+	for(int i = 0; i < sources.size(); ++i) {
+		const QString object = tree.objectFor(sources[i]);
+		pool.start(new UnitTask(this, &units, sources[i], object, &results[i], &completed, sources.size()));
+		inputs << object;
+	}
+	pool.waitForDone();
+	
+	OutputList ret;
+	foreach(const Output &output, results) ret << output;
+	if(!isSuccess(ret) || isCancelled()) return ret;
+	
+	// Link the prebuilt runtime shim rather than compiling target.c again;
+	// it is held until the link below is done
+	Output failure;
+	QScopedPointer<TargetShim::Use> shim(m_targetShim ? new TargetShim::Use(opts, failure) : 0);
+	if(shim) {
+		if(shim->object().isEmpty()) {
+			post(failure);
+			return ret << failure;
+		}
+		inputs << shim->object();
+	}
+	
+	// Invoke pcompiler on the objects and remaining files
+	Engine engine(Compilers::instance()->compilers());
+	setStage(sources.isEmpty() ? 0.0 : 0.5, sources.isEmpty() ? 1.0 : 0.5);
+	const OutputList linked = engine.compile(Input::fromList(inputs), opts, this);
+	post(linked);
+	ret << linked;
 	
-  bool success = true;
-  foreach(const Compiler::Output &o, ret) success &= o.isSuccess();
-  
 	// Copy terminal files to the appropriate directories
-	if(success) ret << RootManager(USER_ROOT).install(ret, m_name);
+	if(isSuccess(ret) && !isCancelled()) {
+		const OutputList installed = RootManager(USER_ROOT).install(ret, m_name);
+		post(installed);
+		ret << installed;
+	}
   
 	return ret;
 }
 
-QString CompileWorker::tempPath()
+bool CompileWorker::isSuccess(const Compiler::OutputList &output)
+{
+	bool success = true;
+	foreach(const Compiler::Output &o, output) success &= o.isSuccess();
+	return success;
+}
+
+void CompileWorker::setStage(const double base, const double span)
+{
+	QMutexLocker locker(&m_mutex);
+	m_stageBase = base;
+	m_stageSpan = span;
+}
+
+void CompileWorker::post(const Compiler::Output &output)
+{
+	if(!m_streaming) return;
+	
+	Diagnostic diagnostic;
+	diagnostic.metadata = "co";
+	QDataStream stream(&diagnostic.data, QIODevice::WriteOnly);
+	stream << output;
+	
+	QMutexLocker locker(&m_mutex);
+	m_diagnostics.append(diagnostic);
+}
+
+void CompileWorker::post(const Compiler::OutputList &output)
 {
-	return QDir::tempPath() + "/" + QDateTime::currentDateTime().toString("yyMMddhhmmss")
-		+ ".kovan-serial";
+	foreach(const Compiler::Output &o, output) post(o);
 }
@@ -0,0 +1,99 @@
+#include "config_cache.hpp"
+#include "constants.hpp"
+
+#include <kovan/config.hpp>
+
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDebug>
+
+static ConfigCache *s_instance = 0;
+
+ConfigCache::~ConfigCache()
+{
+	s_instance = 0;
+}
+
+int ConfigCache::generation() const
+{
+	return m_generation;
+}
+
+int ConfigCache::password(bool &loaded, bool &passworded, std::string &password) const
+{
+	QReadLocker locker(&m_lock);
+	loaded = m_loaded;
+	passworded = m_passworded;
+	password = m_password;
+	return m_generation;
+}
+
+QString ConfigCache::deviceName() const
+{
+	QReadLocker locker(&m_lock);
+	return m_deviceName;
+}
+
+ConfigCache *ConfigCache::instance()
+{
+	return s_instance;
+}
+
+void ConfigCache::reload()
+{
+	Config *settings = Config::load(DEVICE_SETTINGS);
+	
+	bool passworded = false;
+	std::string password;
+	QString name = tr("Nameless");
+	if(settings) {
+		name = QString::fromStdString(settings->stringValue("device_name"));
+		settings->beginGroup("kovan_serial");
+		passworded = settings->containsKey("password");
+		if(passworded) password = settings->stringValue("password");
+	}
+	const bool loaded = settings;
+	delete settings;
+	
+	// Editors that save by rename drop the old inode from the watch list.
+	watch();
+	
+	// The directory watch also fires for unrelated files in /etc/kovan;
+	// only a change in what was parsed counts as a new generation.
+	{
+		QWriteLocker locker(&m_lock);
+		if(m_generation > 0 && loaded == m_loaded && passworded == m_passworded
+			&& password == m_password && name == m_deviceName) return;
+		m_loaded = loaded;
+		m_passworded = passworded;
+		m_password = password;
+		m_deviceName = name;
+		m_generation.ref();
+	}
+	
+	qDebug() << "Reloaded" << DEVICE_SETTINGS;
+	emit changed();
+}
+
+ConfigCache::ConfigCache(QObject *parent)
+	: QObject(parent),
+	m_generation(0),
+	m_loaded(false),
+	m_passworded(false),
+	m_watcher(new QFileSystemWatcher(this))
+{
+	// The directory watch catches the file being created or replaced.
+	connect(m_watcher, SIGNAL(fileChanged(QString)), SLOT(reload()));
+	connect(m_watcher, SIGNAL(directoryChanged(QString)), SLOT(reload()));
+	reload();
+	s_instance = this;
+}
+
+void ConfigCache::watch()
+{
+	const QString file = DEVICE_SETTINGS;
+	const QString dir = QFileInfo(file).absolutePath();
+	if(!m_watcher->directories().contains(dir)) m_watcher->addPath(dir);
+	if(QFileInfo(file).exists() && !m_watcher->files().contains(file)) m_watcher->addPath(file);
+}
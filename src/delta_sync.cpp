@@ -0,0 +1,106 @@
+#include "delta_sync.hpp"
+#include "md5_digest.hpp"
+#include "mapped_file.hpp"
+
+#include <QDataStream>
+#include <QFile>
+#include <QAtomicInt>
+#include <QDebug>
+
+#include <cstdio>
+#include <unistd.h>
+
+bool DeltaSync::signature(const QString &path, const quint32 blockSize, QByteArray &out)
+{
+	MappedFile file;
+	if(blockSize == 0 || !file.open(path)) return false;
+	
+	const quint32 blocks = (file.size() + blockSize - 1) / blockSize;
+	QDataStream stream(&out, QIODevice::WriteOnly);
+	stream << blockSize << quint64(file.size()) << Md5Digest::file(path) << blocks;
+	
+	for(quint32 i = 0; i < blocks; ++i) {
+		const char *block = file.data() + quint64(i) * blockSize;
+		const int len = qMin<quint64>(blockSize, file.size() - quint64(i) * blockSize);
+		const QByteArray raw = QByteArray::fromRawData(block, len);
+		stream << weakSum(block, len) << QByteArray::fromHex(Md5Digest::data(raw));
+	}
+	return stream.status() == QDataStream::Ok && !file.isTruncated();
+}
+
+bool DeltaSync::apply(const QString &path, const QByteArray &delta, const qint64 maxBytes)
+{
+	QDataStream stream(delta);
+	QByteArray baseMd5;
+	QByteArray resultMd5;
+	quint32 blockSize = 0;
+	stream >> baseMd5 >> resultMd5 >> blockSize;
+	
+	MappedFile base;
+	if(stream.status() != QDataStream::Ok || blockSize == 0 || !base.open(path)) return false;
+	if(Md5Digest::file(path) != baseMd5.toLower()) {
+		qWarning() << "Delta for" << path << "was computed against a different base";
+		return false;
+	}
+	
+	// Two sessions may rebuild the same archive at once; each gets its own part file
+	static QAtomicInt s_applies;
+	const QString partPath = path + QString(".delta%1.part").arg(s_applies.fetchAndAddRelaxed(1));
+	QFile out(partPath);
+	if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+	
+	// A 'C' op is a few bytes but may copy the whole base, so the running
+	// size is checked before every write
+	qint64 written = 0;
+	bool good = true;
+	for(;;) {
+		quint8 op = 0;
+		stream >> op;
+		if(stream.status() != QDataStream::Ok || op == 'E') break;
+		
+		if(op == 'C') {
+			quint32 first = 0;
+			quint32 count = 0;
+			stream >> first >> count;
+			const quint64 begin = quint64(first) * blockSize;
+			const quint64 end = qMin<quint64>(begin + quint64(count) * blockSize, base.size());
+			if(begin >= end || written + qint64(end - begin) > maxBytes) {
+				good = false;
+				break;
+			}
+			good = out.write(base.data() + begin, end - begin) == qint64(end - begin);
+			written += end - begin;
+		} else if(op == 'L') {
+			QByteArray literal;
+			stream >> literal;
+			good = written + literal.size() <= maxBytes && out.write(literal) == literal.size();
+			written += literal.size();
+		} else good = false;
+		
+		if(!good) break;
+	}
+	good = good && stream.status() == QDataStream::Ok && !base.isTruncated() && out.flush();
+	if(good) fsync(out.handle());
+	out.close();
+	base.close();
+	
+	if(!good || Md5Digest::file(partPath) != resultMd5.toLower()) {
+		qWarning() << "Rebuilding" << path << "from delta failed";
+		QFile::remove(partPath);
+		return false;
+	}
+	
+	return ::rename(QFile::encodeName(partPath).constData(), QFile::encodeName(path).constData()) == 0;
+}
+
+quint32 DeltaSync::weakSum(const char *data, const int len)
+{
+	quint32 a = 0;
+	quint32 b = 0;
+	for(int i = 0; i < len; ++i) {
+		const quint8 byte = data[i];
+		a += byte;
+		b += (len - i) * byte;
+	}
+	return ((b & 0xFFFF) << 16) | (a & 0xFFFF);
+}
@@ -0,0 +1,88 @@
+#include "device_monitor.hpp"
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+#define UEVENT_BUFFER_SIZE 4096
+// Multicast group the kernel broadcasts raw uevents on
+#define UEVENT_KERNEL_GROUP 1
+
+DeviceMonitor::DeviceMonitor()
+	: m_fd(-1)
+{
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+	close();
+}
+
+bool DeviceMonitor::open()
+{
+	close();
+	m_fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if(m_fd < 0) return false;
+	
+	sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = UEVENT_KERNEL_GROUP;
+	if(::bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void DeviceMonitor::close()
+{
+	if(m_fd < 0) return;
+	::close(m_fd);
+	m_fd = -1;
+}
+
+bool DeviceMonitor::isOpen() const
+{
+	return m_fd >= 0;
+}
+
+int DeviceMonitor::fd() const
+{
+	return m_fd;
+}
+
+bool DeviceMonitor::next(Event &event, const int timeout)
+{
+	if(m_fd < 0) return false;
+	
+	if(timeout > 0) {
+		pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int ret = 0;
+		do ret = poll(&pfd, 1, timeout);
+		while(ret < 0 && errno == EINTR);
+		if(ret <= 0) return false;
+	}
+	
+	char buffer[UEVENT_BUFFER_SIZE];
+	ssize_t size = 0;
+	do size = ::recv(m_fd, buffer, sizeof(buffer) - 1, 0);
+	while(size < 0 && errno == EINTR);
+	if(size <= 0) return false;
+	buffer[size] = 0;
+	
+	// "<action>@<devpath>\0KEY=VALUE\0KEY=VALUE\0..."
+	event = Event();
+	for(const char *field = buffer; field < buffer + size; field += strlen(field) + 1) {
+		if(!strncmp(field, "ACTION=", 7)) event.action = field + 7;
+		else if(!strncmp(field, "SUBSYSTEM=", 10)) event.subsystem = field + 10;
+		else if(!strncmp(field, "DEVNAME=", 8)) event.devName = field + 8;
+	}
+	return true;
+}
@@ -0,0 +1,92 @@
+#include "directory_listing.hpp"
+#include "md5_digest.hpp"
+
+#include <QDataStream>
+#include <QFile>
+#include <QDir>
+
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+// procfs and sysfs files report sizes unrelated to their contents, and
+// some (e.g. /proc/kcore) are effectively endless
+#define PROC_SUPER_MAGIC 0x9fa0
+#define SYSFS_MAGIC 0x62656572
+
+// Most entries and serialized bytes one listing holds
+#define LIST_MAX_ENTRIES 8192
+#define LIST_MAX_BYTES (4 * 1024 * 1024)
+
+bool DirectoryListing::build(const QString &root, const int depth, const bool hashes, QByteArray &out)
+{
+	if(!QFileInfo(root).isDir()) return false;
+	
+	// The count is only known after the walk; patch it in at the front.
+	out.clear();
+	QDataStream stream(&out, QIODevice::WriteOnly);
+	stream << quint32(0);
+	quint32 count = 0;
+	if(!walk(stream, QDir(root).absolutePath(), QString(), depth, hashes, count)) {
+		stream << QByteArray() << quint8('t') << quint64(0) << qint64(0) << quint32(0) << QByteArray();
+		++count;
+	}
+	
+	QDataStream header(&out, QIODevice::WriteOnly);
+	header << count;
+	return stream.status() == QDataStream::Ok;
+}
+
+bool DirectoryListing::flat(const QString &path, QByteArray &out)
+{
+	QFileInfo info(path);
+	if(!info.isDir()) return false;
+	
+	out.clear();
+	QList<QFileInfo> entries = info.dir().entryInfoList(QDir::NoDot |
+		QDir::NoDotDot | QDir::Dirs | QDir::Files);
+	foreach(const QFileInfo &entry, entries) {
+		char typeChar = 0;
+		if(entry.isDir()) typeChar = 'd';
+		else if(entry.isFile()) typeChar = 'f';
+		else if(entry.isSymLink()) typeChar = 'l';
+		else typeChar = '?';
+		
+		out += typeChar;
+		out += " " + entry.fileName().toUtf8() + "\n";
+	}
+	return true;
+}
+
+bool DirectoryListing::walk(QDataStream &stream, const QString &root, const QString &relative,
+	const int depth, const bool hashes, quint32 &count)
+{
+	const QString dirPath = relative.isEmpty() ? root : root + "/" + relative;
+	const QStringList names = QDir(dirPath).entryList(QDir::NoDotAndDotDot | QDir::System
+		| QDir::Hidden | QDir::AllDirs | QDir::Files, QDir::Name);
+	
+	struct statfs fs;
+	const bool pseudo = statfs(QFile::encodeName(dirPath).constData(), &fs) == 0
+		&& (fs.f_type == PROC_SUPER_MAGIC || fs.f_type == SYSFS_MAGIC);
+	
+	foreach(const QString &name, names) {
+		if(count >= LIST_MAX_ENTRIES || stream.device()->size() >= LIST_MAX_BYTES) return false;
+		
+		const QString entry = relative.isEmpty() ? name : relative + "/" + name;
+		const QString path = root + "/" + entry;
+		
+		struct stat st;
+		if(lstat(QFile::encodeName(path).constData(), &st) < 0) continue;
+		
+		quint8 type = '?';
+		if(S_ISDIR(st.st_mode)) type = 'd';
+		else if(S_ISREG(st.st_mode)) type = 'f';
+		else if(S_ISLNK(st.st_mode)) type = 'l';
+		
+		stream << entry.toUtf8() << type << quint64(st.st_size) << qint64(st.st_mtime)
+			<< quint32(st.st_mode) << (hashes && type == 'f' && !pseudo ? Md5Digest::file(path) : QByteArray());
+		++count;
+		
+		if(type == 'd' && depth > 1 && !walk(stream, root, entry, depth - 1, hashes, count)) return false;
+	}
+	return true;
+}
@@ -0,0 +1,54 @@
+#include "file_utils.hpp"
+
+#include <QFileInfo>
+#include <QDir>
+
+#define ENTRY_FILTERS (QDir::NoDotAndDotDot | QDir::System | QDir::Hidden \
+	| QDir::AllDirs | QDir::Files)
+
+bool FileUtils::removeRecursively(const QString &path)
+{
+	QDir dir(path);
+
+	if(!dir.exists()) return true;
+
+	QFileInfoList entries = dir.entryInfoList(ENTRY_FILTERS, QDir::DirsFirst);
+
+	foreach(const QFileInfo& entry, entries) {
+		const QString entryPath = entry.absoluteFilePath();
+		if(!(entry.isDir() ? removeRecursively(entryPath) : QFile::remove(entryPath))) return false;
+	}
+
+	if(!dir.rmdir(path)) return false;
+
+	return true;
+}
+
+bool FileUtils::copyRecursively(const QString &from, const QString &to)
+{
+	QFileInfo info(from);
+	if(!info.isDir()) {
+		QFile::remove(to);
+		if(!QFile::copy(from, to)) return false;
+		return QFile::setPermissions(to, info.permissions());
+	}
+	
+	if(!QDir().mkpath(to)) return false;
+	
+	QFileInfoList entries = QDir(from).entryInfoList(ENTRY_FILTERS);
+	foreach(const QFileInfo &entry, entries) {
+		if(!copyRecursively(entry.absoluteFilePath(), to + "/" + entry.fileName())) return false;
+	}
+	return true;
+}
+
+qint64 FileUtils::diskUsage(const QString &path)
+{
+	QFileInfo info(path);
+	if(!info.isDir()) return info.size();
+	
+	qint64 ret = 0;
+	QFileInfoList entries = QDir(path).entryInfoList(ENTRY_FILTERS);
+	foreach(const QFileInfo &entry, entries) ret += diskUsage(entry.absoluteFilePath());
+	return ret;
+}
@@ -0,0 +1,146 @@
+#include "framebuffer.hpp"
+
+#include <QFile>
+#include <QDebug>
+
+#include <linux/fb.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FRAMEBUFFER_DEVICE "/dev/fb0"
+// How long a device that failed to open is left alone before trying again
+#define FRAMEBUFFER_RETRY_MS 1000
+
+Framebuffer::~Framebuffer()
+{
+	close();
+}
+
+bool Framebuffer::isOpen()
+{
+	QMutexLocker locker(&m_mutex);
+	return open();
+}
+
+int Framebuffer::width()
+{
+	QMutexLocker locker(&m_mutex);
+	return open() ? m_width : 0;
+}
+
+int Framebuffer::height()
+{
+	QMutexLocker locker(&m_mutex);
+	return open() ? m_height : 0;
+}
+
+int Framebuffer::bitsPerPixel()
+{
+	QMutexLocker locker(&m_mutex);
+	return open() ? m_bpp : 0;
+}
+
+QByteArray Framebuffer::grabRaw()
+{
+	QMutexLocker locker(&m_mutex);
+	if(!open()) return QByteArray();
+	return QByteArray(reinterpret_cast<const char *>(m_data), m_size);
+}
+
+QByteArray Framebuffer::grab(int &width, int &height)
+{
+	QMutexLocker locker(&m_mutex);
+	width = 0;
+	height = 0;
+	if(!open()) return QByteArray();
+	
+	width = m_width;
+	height = m_height;
+	const int rowBytes = m_width * m_bpp / 8;
+	QByteArray ret(rowBytes * m_height, 0);
+	char *out = ret.data();
+	for(int y = 0; y < m_height; ++y, out += rowBytes) {
+		memcpy(out, m_data + m_offset + y * m_lineLength, rowBytes);
+	}
+	return ret;
+}
+
+Framebuffer *Framebuffer::instance()
+{
+	static Framebuffer s_instance(FRAMEBUFFER_DEVICE);
+	return &s_instance;
+}
+
+Framebuffer::Framebuffer(const QString &device)
+	: m_device(device),
+	m_fd(-1),
+	m_data(0),
+	m_size(0),
+	m_width(0),
+	m_height(0),
+	m_bpp(0),
+	m_lineLength(0),
+	m_offset(0)
+{
+}
+
+bool Framebuffer::open()
+{
+	// Called with m_mutex held. The device stays open; only the mapping
+	// is redone when the mode changes.
+	if(m_fd < 0) {
+		if(m_lastTry.isValid() && m_lastTry.elapsed() < FRAMEBUFFER_RETRY_MS) return false;
+		m_lastTry.start();
+		m_fd = ::open(QFile::encodeName(m_device).constData(), O_RDONLY);
+		if(m_fd < 0) {
+			qWarning() << "Failed to open" << m_device;
+			return false;
+		}
+	}
+	
+	fb_var_screeninfo var;
+	fb_fix_screeninfo fix;
+	if(ioctl(m_fd, FBIOGET_VSCREENINFO, &var) < 0 || ioctl(m_fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+		qWarning() << "Failed to query" << m_device;
+		close();
+		return false;
+	}
+	
+	if(!m_data || m_size != fix.smem_len) {
+		if(m_data) munmap(m_data, m_size);
+		m_data = 0;
+		void *data = mmap(0, fix.smem_len, PROT_READ, MAP_SHARED, m_fd, 0);
+		if(data == MAP_FAILED) {
+			qWarning() << "Failed to map" << m_device;
+			close();
+			return false;
+		}
+		m_data = reinterpret_cast<unsigned char *>(data);
+		m_size = fix.smem_len;
+	}
+	
+	m_width = var.xres;
+	m_height = var.yres;
+	m_bpp = var.bits_per_pixel;
+	m_lineLength = fix.line_length;
+	m_offset = var.yoffset * fix.line_length + var.xoffset * var.bits_per_pixel / 8;
+	
+	// Don't read past the mapping if the reported geometry doesn't fit it
+	if(quint64(m_offset) + quint64(m_height) * m_lineLength > m_size
+		|| m_width * m_bpp / 8 > m_lineLength) {
+		qWarning() << "Inconsistent screen info from" << m_device;
+		return false;
+	}
+	return true;
+}
+
+void Framebuffer::close()
+{
+	if(m_data) munmap(m_data, m_size);
+	if(m_fd >= 0) ::close(m_fd);
+	m_data = 0;
+	m_size = 0;
+	m_fd = -1;
+}
@@ -1,23 +1,35 @@
 #include "heartbeat.hpp"
 #include "constants.hpp"
+#include "config_cache.hpp"
 
-#include <kovan/config.hpp>
 #include <kovanserial/kovan_serial.hpp>
 
 #include <QTimer>
+#include <QUdpSocket>
+#include <QHostAddress>
 #include <QDebug>
 
+#include <cstring>
+
 Heartbeat::Heartbeat(QObject *parent)
 	: QObject(parent),
-	m_advertiser(true)
+	m_advertiser(true),
+	m_responder(new QUdpSocket(this))
 {
+	connect(ConfigCache::instance(), SIGNAL(changed()), SLOT(updateAdvert()));
+	updateAdvert();
+	
+	if(m_responder->bind(QHostAddress::Any, DISCOVERY_PORT, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+		if(!m_responder->joinMulticastGroup(QHostAddress(DISCOVERY_GROUP))) {
+			qWarning() << "Failed to join discovery group" << DISCOVERY_GROUP;
+		}
+		connect(m_responder, SIGNAL(readyRead()), SLOT(respond()));
+	} else qWarning() << "Failed to bind discovery port" << DISCOVERY_PORT;
+	
 	QTimer *timer = new QTimer(this);
 	connect(timer, SIGNAL(timeout()), SLOT(beat()));
-	timer->start(3000);
-	
-	QTimer *timer2 = new QTimer(this);
-	connect(timer2, SIGNAL(timeout()), SLOT(reset()));
-	timer2->start(10000);
+	timer->start(ADVERT_PULSE_MS);
+	beat();
 }
 
 Heartbeat::~Heartbeat()
@@ -28,6 +40,7 @@ Heartbeat::~Heartbeat()
 void Heartbeat::setAdvert(const Advert &advert)
 {
 	m_advert = advert;
+	m_advertData = QByteArray(reinterpret_cast<const char *>(&m_advert), sizeof(m_advert));
 }
 
 const Advert &Heartbeat::advert() const
@@ -35,20 +48,32 @@ const Advert &Heartbeat::advert() const
 	return m_advert;
 }
 
-void Heartbeat::reset()
+void Heartbeat::beat()
 {
+	// The advertiser is built to send once; reset rearms it
+	m_advertiser.reset();
+	m_advertiser.pulse(m_advert);
+}
 
+void Heartbeat::respond()
+{
+	while(m_responder->hasPendingDatagrams()) {
+		QByteArray probe(m_responder->pendingDatagramSize(), 0);
+		QHostAddress sender;
+		quint16 port = 0;
+		if(m_responder->readDatagram(probe.data(), probe.size(), &sender, &port) < 0) continue;
+		if(probe != DISCOVERY_PROBE) continue;
+		m_responder->writeDatagram(m_advertData, sender, port);
+	}
 }
 
-void Heartbeat::beat()
+void Heartbeat::updateAdvert()
 {
-	// TODO: We really, really should cache this and listen for changes with inotify
-	Config *settings = Config::load(DEVICE_SETTINGS);
-	QString name = tr("Nameless");
-	if(settings) name = QString::fromStdString(settings->stringValue("device_name"));
-	m_advert = Advert("Unknown", "Unknown", "KIPR Link", name.toUtf8(), KOVAN_SERIAL_PORT);
-	delete settings;
-	m_advertiser.reset();
-	m_advertiser.pulse(m_advert);
-	// qDebug() << "Beat with" << name;
-}
\ No newline at end of file
+	const QString name = ConfigCache::instance()->deviceName();
+	const Advert advert("Unknown", "Unknown", "KIPR Link", name.toUtf8(), KOVAN_SERIAL_PORT);
+	if(!memcmp(&advert, &m_advert, sizeof(advert)) && !m_advertData.isEmpty()) return;
+	
+	setAdvert(advert);
+	// Let listeners see a rename right away rather than at the next pulse
+	beat();
+}
@@ -1,7 +1,6 @@
 #include <QCoreApplication>
 
 #include <kovanserial/usb_serial.hpp>
-#include <kovanserial/tcp_server.hpp>
 #include <kovanserial/command_types.hpp>
 #include <kovanserial/platform_defines.hpp>
 #include <kovanserial/kovan_serial.hpp>
@@ -10,10 +9,12 @@
 #include "tcp_server_thread.hpp"
 #include "heartbeat.hpp"
 #include "serial_bridge.hpp"
+#include "config_cache.hpp"
+#include "stats_exporter.hpp"
+#include "constants.hpp"
 
 #include <cstdlib>
 #include <cstdio>
-#include <unistd.h>
 
 // #define DEV_MODE
 
@@ -22,37 +23,41 @@ int main(int argc, char *argv[])
 {
 	QCoreApplication app(argc, argv);
 	
+	// Parse the device config once, on the thread that owns its watcher.
+	// Like the bridge below, it outlives the server threads.
+	ConfigCache config;
+	// The launcher connection is likewise owned by the main thread, and
+	// outlives the server threads that queue launches on it.
+	SerialBridge bridge;
+	
 	char serialPort[128];
 	if(argc == 2) strncpy(serialPort, argv[1], 128);
 	else strncpy(serialPort, "/dev/ttyGS0", 128);
 	
 	ServerThread *providers[2] = {0, 0};
 	
+	// Network clients are served right away; nothing here waits on the gadget.
+	TcpServerThread *tcp = new TcpServerThread(KOVAN_SERIAL_PORT, TCP_MAX_SESSIONS);
+	if(tcp->listen()) providers[1] = tcp;
+	else {
+		perror("tcp");
+		delete tcp;
+	}
+	
 #ifndef DEV_MODE
+	// The USB thread opens the port itself once the gadget's tty appears.
 	UsbSerial usb(serialPort);
-	// This may execute before the device is ready for opening.
-	// Wait until it is ready.
-	while(!usb.makeAvailable()) {
-		perror("open");
-		sleep(2);
-	}
-	providers[0] = new ServerThread(&usb);
+	providers[0] = new ServerThread(&usb, serialPort);
 #endif
 	
-	TcpServer server;
-	server.bind(KOVAN_SERIAL_PORT);
-	server.listen(2);
-	if(server.makeAvailable()) providers[1] = new TcpServerThread(&server);
-	else perror("tcp");
-	
-  SerialBridge bridge;
-	
 	for(int i = 0; i < 2; ++i) {
 		if(!providers[i]) continue;
-		QObject::connect(providers[i], SIGNAL(run(QString)), &bridge, SLOT(run(QString)));
 		providers[i]->start();
 	}
 	
+	StatsExporter stats;
+	stats.registerOnBus();
+	
 	Heartbeat *heart = new Heartbeat();
 	int ret = app.exec();
 	delete heart;
@@ -67,7 +72,6 @@ int main(int argc, char *argv[])
 #ifndef DEV_MODE
 	usb.endSession();
 #endif
-	server.endSession();
 	
 	return ret;
 }
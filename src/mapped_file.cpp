@@ -0,0 +1,233 @@
+#include "mapped_file.hpp"
+
+#include <QFile>
+#include <QMutex>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstring>
+
+// procfs and sysfs report sizes that have nothing to do with their contents
+#define PROC_SUPER_MAGIC 0x9fa0
+#define SYSFS_MAGIC 0x62656572
+
+// Most bytes a file that can't be mapped (a device, a pseudo file) is read into memory
+#define MAPPED_FILE_MAX_COPY (16 * 1024 * 1024)
+
+// Mappings the SIGBUS handler knows about. A file that shrinks under a
+// mapping faults on the missing pages; the handler swaps them for zero
+// pages and flags the mapping as truncated so the owner can discard it.
+#define GUARD_SLOTS 64
+
+namespace
+{
+	struct GuardSlot
+	{
+		char *volatile begin;
+		volatile size_t size;
+		volatile sig_atomic_t truncated;
+	};
+	
+	GuardSlot s_slots[GUARD_SLOTS];
+	QMutex s_guardMutex;
+	bool s_guardInstalled = false;
+	long s_pageSize = 4096;
+	struct sigaction s_previous;
+	
+	void onSigbus(int sig, siginfo_t *info, void *context)
+	{
+		char *const addr = reinterpret_cast<char *>(info->si_addr);
+		for(int i = 0; i < GUARD_SLOTS; ++i) {
+			char *const begin = s_slots[i].begin;
+			if(!begin || addr < begin || addr >= begin + s_slots[i].size) continue;
+			char *const page = reinterpret_cast<char *>(reinterpret_cast<size_t>(addr) & ~(s_pageSize - 1));
+			if(mmap(page, begin + s_slots[i].size - page, PROT_READ,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) break;
+			s_slots[i].truncated = 1;
+			return;
+		}
+		
+		// Not one of ours; hand it to whoever was installed before
+		if(s_previous.sa_flags & SA_SIGINFO) s_previous.sa_sigaction(sig, info, context);
+		else if(s_previous.sa_handler != SIG_IGN && s_previous.sa_handler != SIG_DFL) s_previous.sa_handler(sig);
+		else sigaction(SIGBUS, &s_previous, 0);
+	}
+	
+	int guard(char *begin, const size_t size)
+	{
+		QMutexLocker locker(&s_guardMutex);
+		if(!s_guardInstalled) {
+			s_pageSize = sysconf(_SC_PAGESIZE);
+			struct sigaction action;
+			memset(&action, 0, sizeof(action));
+			action.sa_sigaction = onSigbus;
+			action.sa_flags = SA_SIGINFO;
+			sigemptyset(&action.sa_mask);
+			if(sigaction(SIGBUS, &action, &s_previous) < 0) return -1;
+			s_guardInstalled = true;
+		}
+		
+		for(int i = 0; i < GUARD_SLOTS; ++i) {
+			if(s_slots[i].begin) continue;
+			s_slots[i].size = size;
+			s_slots[i].truncated = 0;
+			s_slots[i].begin = begin;
+			return i;
+		}
+		return -1;
+	}
+	
+	void unguard(const int slot)
+	{
+		QMutexLocker locker(&s_guardMutex);
+		s_slots[slot].begin = 0;
+		s_slots[slot].size = 0;
+	}
+}
+
+MappedFile::MappedFile()
+	: m_data(0),
+	m_size(0),
+	m_slot(-1),
+	m_open(false),
+	m_stream(&m_buffer)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const QString &path)
+{
+	close();
+	
+	const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+	if(fd < 0) return false;
+	
+	struct stat st;
+	struct statfs fs;
+	if(fstat(fd, &st) < 0 || fstatfs(fd, &fs) < 0 || S_ISDIR(st.st_mode)) {
+		::close(fd);
+		return false;
+	}
+	
+	// Only a regular file on a real filesystem has a size worth trusting
+	const bool pseudo = fs.f_type == PROC_SUPER_MAGIC || fs.f_type == SYSFS_MAGIC;
+	bool good = true;
+	if(!S_ISREG(st.st_mode) || pseudo || st.st_size == 0) good = readAll(fd);
+	else good = map(fd, st.st_size) || readAll(fd);
+	::close(fd);
+	if(!good) {
+		close();
+		return false;
+	}
+	
+	m_open = true;
+	m_buffer.reset(data(), m_size);
+	m_stream.clear();
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(m_slot >= 0) unguard(m_slot);
+	if(m_data) munmap(m_data, m_size);
+	m_data = 0;
+	m_size = 0;
+	m_slot = -1;
+	m_copy.clear();
+	m_open = false;
+	m_buffer.reset(0, 0);
+}
+
+bool MappedFile::isOpen() const
+{
+	return m_open;
+}
+
+bool MappedFile::isTruncated() const
+{
+	return m_slot >= 0 && s_slots[m_slot].truncated;
+}
+
+const char *MappedFile::data() const
+{
+	return m_data ? reinterpret_cast<const char *>(m_data) : m_copy.constData();
+}
+
+size_t MappedFile::size() const
+{
+	return m_size;
+}
+
+std::istream *MappedFile::stream()
+{
+	return &m_stream;
+}
+
+bool MappedFile::map(const int fd, const size_t size)
+{
+	void *const data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED) return false;
+	
+	// Without a guard slot a shrinking file would kill the server; copy instead
+	const int slot = guard(reinterpret_cast<char *>(data), size);
+	if(slot < 0) {
+		munmap(data, size);
+		return false;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+	
+	m_data = data;
+	m_size = size;
+	m_slot = slot;
+	return true;
+}
+
+bool MappedFile::readAll(const int fd)
+{
+	m_copy.clear();
+	char buffer[64 * 1024];
+	for(off_t offset = 0;;) {
+		const ssize_t got = pread(fd, buffer, sizeof(buffer), offset);
+		if(got < 0) return false;
+		if(got == 0) break;
+		if(m_copy.size() + got > MAPPED_FILE_MAX_COPY) return false;
+		m_copy.append(buffer, got);
+		offset += got;
+	}
+	m_size = m_copy.size();
+	return true;
+}
+
+void MappedFile::Buffer::reset(const char *data, const size_t size)
+{
+	char *begin = const_cast<char *>(data);
+	setg(begin, begin, begin + size);
+}
+
+MappedFile::Buffer::pos_type MappedFile::Buffer::seekoff(off_type off, std::ios_base::seekdir dir,
+	std::ios_base::openmode which)
+{
+	if(!(which & std::ios_base::in)) return pos_type(off_type(-1));
+	
+	off_type base = 0;
+	if(dir == std::ios_base::cur) base = gptr() - eback();
+	else if(dir == std::ios_base::end) base = egptr() - eback();
+	
+	const off_type target = base + off;
+	if(target < 0 || target > egptr() - eback()) return pos_type(off_type(-1));
+	setg(eback(), eback() + target, egptr());
+	return pos_type(target);
+}
+
+MappedFile::Buffer::pos_type MappedFile::Buffer::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
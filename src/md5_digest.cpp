@@ -0,0 +1,39 @@
+#include "md5_digest.hpp"
+
+#include <kovanserial/md5.hpp>
+
+#include <QFile>
+
+#define READ_BLOCK (64 * 1024)
+
+static QByteArray finish(md5_state_t *state)
+{
+	md5_byte_t digest[16];
+	md5_finish(state, digest);
+	return QByteArray(reinterpret_cast<const char *>(digest), sizeof(digest)).toHex();
+}
+
+QByteArray Md5Digest::data(const QByteArray &data)
+{
+	md5_state_t state;
+	md5_init(&state);
+	md5_append(&state, reinterpret_cast<const md5_byte_t *>(data.constData()), data.size());
+	return finish(&state);
+}
+
+QByteArray Md5Digest::file(const QString &path, const qint64 length)
+{
+	QFile file(path);
+	if(!file.open(QIODevice::ReadOnly)) return QByteArray();
+	
+	md5_state_t state;
+	md5_init(&state);
+	qint64 remaining = length < 0 ? file.size() : length;
+	while(remaining > 0) {
+		const QByteArray block = file.read(qMin<qint64>(remaining, READ_BLOCK));
+		if(block.isEmpty()) return QByteArray();
+		md5_append(&state, reinterpret_cast<const md5_byte_t *>(block.constData()), block.size());
+		remaining -= block.size();
+	}
+	return finish(&state);
+}
@@ -0,0 +1,110 @@
+#include "partial_upload.hpp"
+#include "md5_digest.hpp"
+
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QRegExp>
+#include <QDebug>
+
+#include <cstdio>
+#include <unistd.h>
+
+#define PART_SUFFIX ".part"
+// Part files untouched for this long belong to abandoned uploads
+#define PART_MAX_AGE_SECS (24 * 60 * 60)
+
+PartialUpload::PartialUpload(const QString &dest, const QByteArray &md5, const qint64 size)
+	: m_dest(dest),
+	m_md5(md5.toLower()),
+	m_size(size)
+{
+}
+
+bool PartialUpload::isValidMd5(const QByteArray &md5)
+{
+	return QRegExp("[0-9a-fA-F]{32}").exactMatch(QString::fromLatin1(md5));
+}
+
+void PartialUpload::removeAbandoned() const
+{
+	const QFileInfo dest(m_dest);
+	const QString current = QFileInfo(partPath()).fileName();
+	const QDateTime cutoff = QDateTime::currentDateTime().addSecs(-PART_MAX_AGE_SECS);
+	QDir dir(dest.absolutePath());
+	// Only "<name>.<md5>-<size>.part" belongs to this archive; "foo.bar.*"
+	// and a plain upload's "<name>.part" are someone else's
+	const QRegExp sibling(QRegExp::escape(dest.fileName()) + "\\.[0-9a-f]{32}-\\d+" + QRegExp::escape(PART_SUFFIX));
+	foreach(const QFileInfo &part, dir.entryInfoList(QStringList() << "*" PART_SUFFIX, QDir::Files)) {
+		if(part.fileName() == current) continue;
+		if(sibling.exactMatch(part.fileName()) || part.lastModified() < cutoff) {
+			QFile::remove(part.absoluteFilePath());
+		}
+	}
+}
+
+qint64 PartialUpload::size() const
+{
+	return m_size;
+}
+
+qint64 PartialUpload::held() const
+{
+	if(isCommitted()) return m_size;
+	return qMin(QFileInfo(partPath()).size(), m_size);
+}
+
+QByteArray PartialUpload::heldMd5() const
+{
+	if(isCommitted()) return m_md5;
+	return Md5Digest::file(partPath(), held());
+}
+
+bool PartialUpload::isCommitted() const
+{
+	return !QFileInfo(partPath()).exists() && QFileInfo(m_dest).size() == m_size
+		&& Md5Digest::file(m_dest) == m_md5;
+}
+
+bool PartialUpload::append(const qint64 offset, const QByteArray &chunk, const QByteArray &chunkMd5)
+{
+	if(Md5Digest::data(chunk) != chunkMd5.toLower()) {
+		qWarning() << "Dropping chunk at" << offset << "for" << m_dest << "- checksum mismatch";
+		return false;
+	}
+	
+	QFile part(partPath());
+	const QIODevice::OpenMode mode = offset == 0
+		? QIODevice::WriteOnly | QIODevice::Truncate
+		: QIODevice::WriteOnly | QIODevice::Append;
+	if(!accepts(offset)) return false;
+	if(offset + chunk.size() > m_size || !part.open(mode)) return false;
+	
+	if(part.write(chunk) != chunk.size() || !part.flush()) return false;
+	fsync(part.handle());
+	part.close();
+	
+	return held() < m_size || commit();
+}
+
+bool PartialUpload::accepts(const qint64 offset) const
+{
+	return isValidMd5(m_md5) && (offset == 0 || offset == held());
+}
+
+QString PartialUpload::partPath() const
+{
+	return m_dest + "." + m_md5 + "-" + QString::number(m_size) + PART_SUFFIX;
+}
+
+bool PartialUpload::commit()
+{
+	if(Md5Digest::file(partPath()) != m_md5) {
+		qWarning() << "Upload of" << m_dest << "failed verification; restarting";
+		QFile::remove(partPath());
+		return false;
+	}
+	return ::rename(QFile::encodeName(partPath()).constData(),
+		QFile::encodeName(m_dest).constData()) == 0;
+}
@@ -0,0 +1,211 @@
+#include "pipeline.hpp"
+#include "constants.hpp"
+#include "compile_worker.hpp"
+#include "compile_scheduler.hpp"
+#include "directory_listing.hpp"
+#include "delta_sync.hpp"
+#include "mapped_file.hpp"
+#include "stats.hpp"
+#include "batch_read.hpp"
+
+#include <kovanserial/command_types.hpp>
+#include <pcompiler/root_manager.hpp>
+
+#include <QRunnable>
+#include <QDataStream>
+#include <QFileInfo>
+
+// Requests of one session run at most this many at a time
+#define PIPELINE_MAX_JOBS 4
+#define PIPELINE_MAX_OUTSTANDING 64
+// Pipelined reads are buffered whole; bigger files use COMMAND_ACTION_READ
+#define PIPELINE_MAX_READ (4 * 1024 * 1024)
+// How often a pipelined compile checks whether it was cancelled
+#define PIPELINE_POLL_MS 100
+
+// Deepest tree COMMAND_ACTION_LIST will walk
+#define LIST_MAX_DEPTH 32
+
+// Block size bounds for archive signatures
+#define DELTA_MIN_BLOCK 256
+#define DELTA_MAX_BLOCK (64 * 1024)
+
+class PipelineTask : public QRunnable
+{
+public:
+	PipelineTask(Pipeline *pipeline, const int generation, const QByteArray &id,
+		const QString &action, const QString &dest)
+		: m_pipeline(pipeline),
+		m_generation(generation),
+		m_id(id),
+		m_action(action),
+		m_dest(dest)
+	{
+	}
+	
+	void run()
+	{
+		Pipeline::Response response;
+		response.id = m_id;
+		response.good = false;
+		// Requests dropped by cancelAll() before they started are skipped
+		if(m_pipeline->isCurrent(m_generation)) {
+			response.good = m_action == COMMAND_ACTION_COMPILE
+				? m_pipeline->compile(m_generation, m_dest, response.data)
+				: Pipeline::execute(m_action, m_dest, response.data);
+		}
+		if(!response.good) response.data.clear();
+		m_pipeline->finished(response, m_generation);
+	}
+	
+private:
+	Pipeline *m_pipeline;
+	int m_generation;
+	QByteArray m_id;
+	QString m_action;
+	QString m_dest;
+};
+
+Pipeline::Pipeline()
+	: m_generation(0),
+	m_outstanding(0)
+{
+	m_pool.setMaxThreadCount(PIPELINE_MAX_JOBS);
+}
+
+Pipeline::~Pipeline()
+{
+	// Cancelled compiles are abandoned, so this only waits for short requests
+	cancelAll();
+	m_pool.waitForDone();
+}
+
+bool Pipeline::submit(const QByteArray &id, const QString &action, const QString &dest)
+{
+	if(!isPipelined(action)) return false;
+	
+	QMutexLocker locker(&m_mutex);
+	if(m_outstanding >= PIPELINE_MAX_OUTSTANDING || m_ids.contains(id)) return false;
+	++m_outstanding;
+	m_ids.insert(id);
+	const int generation = m_generation;
+	locker.unlock();
+	
+	m_pool.start(new PipelineTask(this, generation, id, action, dest));
+	return true;
+}
+
+void Pipeline::cancelAll()
+{
+	QMutexLocker locker(&m_mutex);
+	++m_generation;
+	m_outstanding = 0;
+	m_done.clear();
+	m_ids.clear();
+	foreach(const CompileWorkerPtr &worker, m_workers) worker->cancel();
+	m_workers.clear();
+}
+
+int Pipeline::outstanding() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_outstanding;
+}
+
+bool Pipeline::next(Response &response, const unsigned long timeout)
+{
+	QMutexLocker locker(&m_mutex);
+	if(m_done.isEmpty()) m_ready.wait(&m_mutex, timeout);
+	if(m_done.isEmpty()) return false;
+	
+	response = m_done.dequeue();
+	--m_outstanding;
+	m_ids.remove(response.id);
+	return true;
+}
+
+bool Pipeline::isPipelined(const QString &action)
+{
+	return action == COMMAND_ACTION_READ
+		|| action == COMMAND_ACTION_LIST
+		|| action == COMMAND_ACTION_KAR_SIGNATURE
+		|| action == COMMAND_ACTION_STATS
+		|| action == COMMAND_ACTION_READ_BATCH
+		|| action == COMMAND_ACTION_COMPILE;
+}
+
+bool Pipeline::execute(const QString &action, const QString &dest, QByteArray &out)
+{
+	if(action == COMMAND_ACTION_READ) {
+		if(QFileInfo(dest).isDir()) return DirectoryListing::flat(dest, out);
+		
+		MappedFile file;
+		if(!file.open(dest) || file.size() > PIPELINE_MAX_READ) return false;
+		out = QByteArray(file.data(), file.size());
+		return !file.isTruncated();
+	}
+	
+	if(action == COMMAND_ACTION_LIST) {
+		// dest is "<depth>:<flags>:<path>"; flag 'h' adds content hashes
+		const int depth = qBound(1, dest.section(':', 0, 0).toInt(), LIST_MAX_DEPTH);
+		const bool hashes = dest.section(':', 1, 1).contains('h');
+		return DirectoryListing::build(dest.section(':', 2), depth, hashes, out);
+	}
+	
+	if(action == COMMAND_ACTION_KAR_SIGNATURE) {
+		// dest is "<block size>:<name>"
+		const quint32 blockSize = qBound(DELTA_MIN_BLOCK, dest.section(':', 0, 0).toInt(), DELTA_MAX_BLOCK);
+		Compiler::RootManager root(USER_ROOT);
+		return DeltaSync::signature(root.archivesPath(dest.section(':', 1)), blockSize, out);
+	}
+	
+	if(action == COMMAND_ACTION_READ_BATCH) return BatchRead::build(dest, out);
+	
+	if(action == COMMAND_ACTION_STATS) {
+		out = Stats::instance()->toText();
+		return true;
+	}
+	
+	return false;
+}
+
+bool Pipeline::isCurrent(const int generation) const
+{
+	QMutexLocker locker(&m_mutex);
+	return generation == m_generation;
+}
+
+bool Pipeline::compile(const int generation, const QString &dest, QByteArray &out)
+{
+	// The serialized OutputList a plain compile ends with
+	CompileWorkerPtr worker = CompileWorker::forProject(dest);
+	if(worker.isNull()) return false;
+	
+	QMutexLocker locker(&m_mutex);
+	if(generation != m_generation) return false;
+	m_workers << worker;
+	locker.unlock();
+	
+	// Like a plain compile, a cancelled job is abandoned right away
+	CompileScheduler::instance()->enqueue(worker);
+	while(!worker->wait(PIPELINE_POLL_MS) && !worker->isCancelled());
+	
+	locker.relock();
+	m_workers.removeAll(worker);
+	locker.unlock();
+	if(worker->isCancelled()) return false;
+	
+	out.clear();
+	QDataStream stream(&out, QIODevice::WriteOnly);
+	stream << worker->output();
+	return true;
+}
+
+void Pipeline::finished(const Response &response, const int generation)
+{
+	QMutexLocker locker(&m_mutex);
+	// Nobody is waiting for requests dropped by cancelAll()
+	if(generation != m_generation) return;
+	m_done.enqueue(response);
+	m_ready.wakeOne();
+}
@@ -2,21 +2,90 @@
 
 #include <QStringList>
 #include <QSettings>
+#include <QThread>
+#include <QFile>
+#include <QUrl>
+#include <QDebug>
+
+#include <unistd.h>
+
+#define PROPERTIES_PATH "/kovan/.serial_properties"
+#define PROPERTIES_JOURNAL PROPERTIES_PATH ".journal"
+// Changes made within this window reach the journal in a single write
+#define PROPERTIES_COALESCE_MS 500
+// Journal size at which it is folded into the settings file
+#define PROPERTIES_COMPACT_BYTES (16 * 1024)
+
+class Properties::Writer : public QThread
+{
+public:
+	Writer(Properties *owner)
+		: m_owner(owner)
+	{
+	}
+	
+	void run()
+	{
+		QMutexLocker locker(&m_owner->m_mutex);
+		for(;;) {
+			if(m_owner->m_pending.isEmpty()) {
+				if(m_owner->m_stop) break;
+				m_owner->m_dirty.wait(&m_owner->m_mutex);
+				continue;
+			}
+			
+			// Let the rest of a burst arrive
+			if(!m_owner->m_stop) {
+				locker.unlock();
+				msleep(PROPERTIES_COALESCE_MS);
+				locker.relock();
+			}
+			
+			const QList<QByteArray> lines = m_owner->m_pending;
+			m_owner->m_pending.clear();
+			
+			locker.unlock();
+			m_owner->append(lines);
+			locker.relock();
+		}
+	}
+	
+private:
+	Properties *m_owner;
+};
 
 Properties::~Properties()
 {
-	delete m_settings;
+	m_mutex.lock();
+	m_stop = true;
+	m_dirty.wakeAll();
+	m_mutex.unlock();
+	m_writer->wait();
+	delete m_writer;
+	
+	compact();
 }
 
 void Properties::setValue(const QString &property, const QString &value)
 {
-	m_properties[property] = value;
-	sync();
+	// m_mutex orders writers, so the snapshot can be modified outside the
+	// short lock and swapped back in
+	QMutexLocker locker(&m_mutex);
+	PropertyMap next = snapshot();
+	if(next.contains(property) && next.value(property) == value) return;
+	next.insert(property, value);
+	
+	m_snapshotMutex.lock();
+	m_snapshot = next;
+	m_snapshotMutex.unlock();
+	
+	m_pending << QUrl::toPercentEncoding(property) + "=" + QUrl::toPercentEncoding(value) + "\n";
+	m_dirty.wakeOne();
 }
 
 QString Properties::value(const QString &property) const
 {
-	return m_properties.value(property);
+	return snapshot().value(property);
 }
 	
 Properties *Properties::instance()
@@ -25,19 +94,84 @@ Properties *Properties::instance()
 	return &s_instance;
 }
 
-void Properties::sync()
+Properties::Properties()
+	: m_stop(false),
+	m_writer(new Writer(this))
+{
+	load();
+	m_writer->start(QThread::LowPriority);
+}
+
+void Properties::load()
 {
-	foreach(const QString &key, m_properties.keys()) {
-		m_settings->setValue(key, m_properties[key]);
+	PropertyMap properties;
+	QSettings settings(PROPERTIES_PATH, QSettings::IniFormat);
+	foreach(const QString &key, settings.allKeys()) {
+		properties.insert(key, settings.value(key).toString());
 	}
-	m_settings->sync();
+	
+	// Replay changes that were journaled but not yet compacted
+	QFile journal(PROPERTIES_JOURNAL);
+	if(journal.open(QIODevice::ReadOnly)) {
+		while(!journal.atEnd()) {
+			// Only complete lines count; a torn final line from a crash
+			// mid-append is dropped even if it already holds a '='
+			QByteArray line = journal.readLine();
+			if(!line.endsWith('\n')) break;
+			line.chop(1);
+			const int split = line.indexOf('=');
+			if(split < 0) continue;
+			properties.insert(QUrl::fromPercentEncoding(line.left(split)),
+				QUrl::fromPercentEncoding(line.mid(split + 1)));
+		}
+		journal.close();
+	}
+	
+	m_snapshotMutex.lock();
+	m_snapshot = properties;
+	m_snapshotMutex.unlock();
+	compact();
 }
 
-Properties::Properties()
-	: m_settings(new QSettings("/kovan/.serial_properties", QSettings::IniFormat))
-{	
-	foreach(const QString &key, m_settings->allKeys()) {
-		m_properties[key] = m_settings->value(key).toString();
+void Properties::append(const QList<QByteArray> &lines)
+{
+	QFile journal(PROPERTIES_JOURNAL);
+	if(!journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		qWarning() << "Failed to open" << PROPERTIES_JOURNAL;
+		compact();
+		return;
+	}
+	
+	QByteArray data;
+	foreach(const QByteArray &line, lines) data += line;
+	journal.write(data);
+	journal.flush();
+	::fsync(journal.handle());
+	
+	const bool full = journal.size() >= PROPERTIES_COMPACT_BYTES;
+	journal.close();
+	if(full) compact();
+}
+
+void Properties::compact()
+{
+	// Only the writer thread (or the constructor and destructor, when it
+	// is not running) touches the files.
+	const PropertyMap properties = snapshot();
+	QSettings settings(PROPERTIES_PATH, QSettings::IniFormat);
+	for(PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it) {
+		settings.setValue(it.key(), it.value());
 	}
+	settings.sync();
+	if(settings.status() != QSettings::NoError) return;
+	
+	// Replaying the journal over the compacted file is idempotent, so a
+	// crash before this truncation loses nothing.
+	QFile::resize(PROPERTIES_JOURNAL, 0);
 }
 
+PropertyMap Properties::snapshot() const
+{
+	QMutexLocker locker(&m_snapshotMutex);
+	return m_snapshot;
+}
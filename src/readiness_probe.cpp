@@ -0,0 +1,60 @@
+#include "readiness_probe.hpp"
+
+#include <QFile>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+ReadinessProbe::ReadinessProbe()
+	: m_fd(-1)
+{
+}
+
+ReadinessProbe::~ReadinessProbe()
+{
+	close();
+}
+
+bool ReadinessProbe::open(const QString &path)
+{
+	close();
+	m_fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	return m_fd >= 0;
+}
+
+void ReadinessProbe::close()
+{
+	if(m_fd < 0) return;
+	::close(m_fd);
+	m_fd = -1;
+}
+
+bool ReadinessProbe::isOpen() const
+{
+	return m_fd >= 0;
+}
+
+ReadinessProbe::Result ReadinessProbe::wait(const int timeout, const int wakeFd)
+{
+	if(m_fd < 0) return Failed;
+
+	pollfd pfds[2];
+	pfds[0].fd = m_fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	pfds[1].fd = wakeFd;
+	pfds[1].events = POLLIN;
+	pfds[1].revents = 0;
+
+	int ret = 0;
+	do ret = poll(pfds, wakeFd < 0 ? 1 : 2, timeout);
+	while(ret < 0 && errno == EINTR);
+
+	if(ret < 0) return Failed;
+	if(ret == 0) return Idle;
+	if(pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) return Failed;
+	if(pfds[0].revents & POLLIN) return Ready;
+	return Woken;
+}
@@ -0,0 +1,62 @@
+#include "screen_encoder.hpp"
+
+static inline void putU16(char *out, const quint16 value)
+{
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+QByteArray ScreenEncoder::encode(const QByteArray &frame, const int width, const int height)
+{
+	QByteArray ret = header(width, height, 0);
+	appendRuns(ret, reinterpret_cast<const quint16 *>(frame.constData()), frame.size() / 2, 0);
+	return ret;
+}
+
+QByteArray ScreenEncoder::encodeDelta(const QByteArray &previous, const QByteArray &frame,
+	const int width, const int height)
+{
+	if(previous.size() != frame.size()) return encode(frame, width, height);
+	
+	QByteArray ret = header(width, height, Delta);
+	appendRuns(ret, reinterpret_cast<const quint16 *>(frame.constData()), frame.size() / 2,
+		reinterpret_cast<const quint16 *>(previous.constData()));
+	return ret;
+}
+
+QByteArray ScreenEncoder::header(const int width, const int height, const quint8 flags)
+{
+	QByteArray ret("K565");
+	ret.resize(9);
+	putU16(ret.data() + 4, width);
+	putU16(ret.data() + 6, height);
+	ret[8] = flags;
+	return ret;
+}
+
+void ScreenEncoder::appendRuns(QByteArray &out, const quint16 *pixels, const int count,
+	const quint16 *previous)
+{
+	// Worst case is one run per pixel; write into a preallocated buffer
+	// and trim once at the end.
+	const int start = out.size();
+	out.resize(start + count * 4);
+	char *w = out.data() + start;
+	
+	int i = 0;
+	while(i < count) {
+		const quint16 value = previous ? pixels[i] ^ previous[i] : pixels[i];
+		int run = 1;
+		while(i + run < count && run < 0xFFFF) {
+			const quint16 next = previous ? pixels[i + run] ^ previous[i + run] : pixels[i + run];
+			if(next != value) break;
+			++run;
+		}
+		putU16(w, run);
+		putU16(w + 2, value);
+		w += 4;
+		i += run;
+	}
+	
+	out.resize(w - out.constData());
+}
@@ -1,15 +1,162 @@
 #include "serial_bridge.hpp"
 
 #include <QLocalSocket>
+#include <QTimer>
+#include <QDebug>
 
-bool SerialBridge::run(const QString &path)
-{
-  QLocalSocket socket;
-  socket.connectToServer("org.kipr.botui.Run");
-  if(!socket.waitForConnected(2000)) return false;
-  socket.write(path.toUtf8());
-  if(!socket.waitForReadyRead(2000)) return false;
-  const bool ret = socket.readAll()[0];
-  socket.disconnectFromServer();
-  return ret;
-}
\ No newline at end of file
+#define LAUNCHER_SERVER "org.kipr.botui.Run"
+// How long one launch may take from being queued to being answered
+#define LAUNCH_TIMEOUT_MS 4000
+
+static QMutex s_instanceMutex;
+static SerialBridge *s_instance = 0;
+
+LaunchTicket::LaunchTicket(const QString &path)
+	: m_path(path),
+	m_done(false),
+	m_launched(false),
+	m_abandoned(false)
+{
+	m_queued.start();
+}
+
+const QString &LaunchTicket::path() const
+{
+	return m_path;
+}
+
+qint64 LaunchTicket::age() const
+{
+	return m_queued.elapsed();
+}
+
+bool LaunchTicket::wait(const int timeout, bool &launched)
+{
+	QMutexLocker locker(&m_mutex);
+	if(!m_done && timeout > 0) m_finished.wait(&m_mutex, timeout);
+	launched = m_launched;
+	return m_done;
+}
+
+void LaunchTicket::finish(const bool launched)
+{
+	QMutexLocker locker(&m_mutex);
+	m_done = true;
+	m_launched = launched;
+	m_finished.wakeAll();
+}
+
+void LaunchTicket::abandon()
+{
+	QMutexLocker locker(&m_mutex);
+	m_abandoned = true;
+}
+
+bool LaunchTicket::isAbandoned()
+{
+	QMutexLocker locker(&m_mutex);
+	return m_abandoned;
+}
+
+SerialBridge::SerialBridge(QObject *parent)
+	: QObject(parent),
+	m_socket(0),
+	m_timeout(new QTimer(this))
+{
+	m_timeout->setSingleShot(true);
+	connect(m_timeout, SIGNAL(timeout()), SLOT(failed()));
+	
+	QMutexLocker locker(&s_instanceMutex);
+	s_instance = this;
+}
+
+SerialBridge::~SerialBridge()
+{
+	s_instanceMutex.lock();
+	s_instance = 0;
+	s_instanceMutex.unlock();
+	
+	if(m_inFlight) finishInFlight(false);
+	QMutexLocker locker(&m_mutex);
+	while(!m_pending.isEmpty()) m_pending.dequeue()->finish(false);
+}
+
+LaunchTicketPtr SerialBridge::launch(const QString &path)
+{
+	LaunchTicketPtr ticket(new LaunchTicket(path));
+	
+	QMutexLocker instanceLocker(&s_instanceMutex);
+	SerialBridge *bridge = s_instance;
+	if(!bridge) {
+		ticket->finish(false);
+		return ticket;
+	}
+	
+	bridge->m_mutex.lock();
+	bridge->m_pending.enqueue(ticket);
+	bridge->m_mutex.unlock();
+	QMetaObject::invokeMethod(bridge, "pump", Qt::QueuedConnection);
+	return ticket;
+}
+
+void SerialBridge::pump()
+{
+	// botui answers each path with one byte, so only one launch is in flight
+	while(!m_inFlight) {
+		QMutexLocker locker(&m_mutex);
+		if(m_pending.isEmpty()) return;
+		LaunchTicketPtr ticket = m_pending.dequeue();
+		if(ticket->isAbandoned()) continue;
+		// Its deadline passed while queued behind another launch; it is
+		// failed now rather than sent late
+		if(ticket->age() >= LAUNCH_TIMEOUT_MS) {
+			ticket->finish(false);
+			continue;
+		}
+		m_inFlight = ticket;
+	}
+	if(m_socket) return;
+	
+	m_socket = new QLocalSocket(this);
+	connect(m_socket, SIGNAL(connected()), SLOT(connected()));
+	connect(m_socket, SIGNAL(readyRead()), SLOT(readAck()));
+	connect(m_socket, SIGNAL(disconnected()), SLOT(failed()));
+	connect(m_socket, SIGNAL(error(QLocalSocket::LocalSocketError)), SLOT(failed()));
+	m_timeout->start(qMax<qint64>(0, LAUNCH_TIMEOUT_MS - m_inFlight->age()));
+	m_socket->connectToServer(LAUNCHER_SERVER);
+}
+
+void SerialBridge::connected()
+{
+	if(m_inFlight) m_socket->write(m_inFlight->path().toUtf8());
+}
+
+void SerialBridge::readAck()
+{
+	char ack = 0;
+	if(!m_inFlight || !m_socket->getChar(&ack)) return;
+	finishInFlight(ack);
+}
+
+void SerialBridge::failed()
+{
+	// A launch whose answer was lost is reported as failed rather than resent
+	if(!m_inFlight) return;
+	qWarning() << "Launcher didn't answer for" << m_inFlight->path();
+	finishInFlight(false);
+}
+
+void SerialBridge::finishInFlight(const bool launched)
+{
+	m_timeout->stop();
+	m_inFlight->finish(launched);
+	m_inFlight.clear();
+	
+	if(m_socket) {
+		m_socket->disconnect(this);
+		m_socket->abort();
+		m_socket->deleteLater();
+		m_socket = 0;
+	}
+	QMetaObject::invokeMethod(this, "pump", Qt::QueuedConnection);
+}
@@ -1,41 +1,40 @@
 #include "server_thread.hpp"
 
-#include "compile_worker.hpp"
-#include "constants.hpp"
+#include "session.hpp"
+#include "stats.hpp"
 
 #include <kovanserial/transmitter.hpp>
 #include <kovanserial/kovan_serial.hpp>
-#include <kovanserial/command_types.hpp>
-#include <kovanserial/general.hpp>
-#include <kovanserial/md5.hpp>
-#include <kovanserial/platform_defines.hpp>
-
-#include <kovan/config.hpp>
-#include <pcompiler/root_manager.hpp>
 
 #include <QDebug>
+#include <QTime>
+#include <QElapsedTimer>
 #include <QFileInfo>
-#include <QDir>
 
-#include <fstream>
-#include <iostream>
-#include <sstream>
+#include <unistd.h>
 
-using namespace Compiler;
+// How long the loop may sit idle before it re-checks m_stop.
+#define IDLE_WAIT_MS 250
+// How long recv may take to collect a packet once input is known to be pending.
+#define PENDING_RECV_MS 50
+// Interval between zero-length writes probing the link for EIO.
+#define HEALTH_CHECK_MS 2000
+// Bounds of the backoff between attempts to reopen a failed link.
+#define RECONNECT_MIN_MS 50
+#define RECONNECT_MAX_MS 2000
 
-ServerThread::ServerThread(Transmitter *transmitter)
+ServerThread::ServerThread(Transmitter *transmitter, const QString &devicePath)
 	: m_stop(false),
+	m_devicePath(devicePath),
+	m_devName(QFileInfo(devicePath).fileName()),
 	m_transmitter(transmitter),
-	m_transport(new TransportLayer(m_transmitter)),
-	m_proto(new KovanSerial(m_transport))
+	m_session(transmitter ? new Session(transmitter, Stats::Usb) : 0)
 {
 }
 
 ServerThread::~ServerThread()
 {
-	delete m_proto;
-	delete m_transport;
-	delete m_transmitter;
+	delete m_session;
 }
 
 void ServerThread::stop()
@@ -50,232 +49,127 @@ bool ServerThread::isStopping() const
 
 void ServerThread::run()
 {
-
+	if(!m_devicePath.isEmpty()) {
+		if(!m_monitor.open()) qWarning() << "No uevent monitor; USB errors are only found by periodic checks";
+		// The gadget may enumerate after startup; attach once its tty appears.
+		attach();
+		if(m_stop) return;
+		if(!m_probe.open(m_devicePath)) qWarning() << "Failed to open readiness probe on" << m_devicePath;
+	}
+	
 	Packet p;
-	unsigned long i = 1;
+	QTime sinceCheck;
+	sinceCheck.start();
 	while(!m_stop) {
-		QThread::msleep(100);
-		TransportLayer::Return ret = m_transport->recv(p, 2);
-		if(ret == TransportLayer::Success && handle(p)); //std::cout << "Finished handling one command" << std::endl;
-		if(ret == TransportLayer::UntrustedSuccess && handleUntrusted(p)); //std::cout << "Finished handling one UNTRUSTED command" << std::endl;
-		
-		// Linux will report an EIO error if the usb device is in an error state.
-		// The only problem is that we have to *write* to get that error code.
-		// This writes an array of size zero every two seconds to check for EIO.
-		if(i++ % 20 == 0) {
-			uint8_t dummy[0];
-			if(m_transmitter->write(dummy, 0) >= 0) continue;
-			qDebug() << "USB ERROR!!!";
-			// USB has entered error state.
-			m_transmitter->endSession();
-			m_transmitter->makeAvailable();
+		// Sleep in poll() until the device has input or the kernel reports
+		// a device event, so commands and disconnects are both handled as
+		// soon as they happen. Without a probe, recv() bounds the idle wait.
+		bool check = false;
+		ReadinessProbe::Result ready = m_probe.isOpen() ? m_probe.wait(IDLE_WAIT_MS, m_monitor.fd()) : ReadinessProbe::Ready;
+		if(ready == ReadinessProbe::Ready) {
+			TransportLayer::Return ret = m_session->transport()->recv(p, m_probe.isOpen() ? PENDING_RECV_MS : IDLE_WAIT_MS);
+			if(ret == TransportLayer::Success && handle(p)); //std::cout << "Finished handling one command" << std::endl;
+			if(ret == TransportLayer::UntrustedSuccess && handleUntrusted(p)); //std::cout << "Finished handling one UNTRUSTED command" << std::endl;
+			if(!m_probe.isOpen()) check = linkEvent();
+		} else if(ready == ReadinessProbe::Woken) check = linkEvent();
+		else if(ready == ReadinessProbe::Failed) {
+			// HUP or an error on the tty: a read error or a gadget disconnect
+			m_probe.close();
+			check = true;
 		}
+		
+		// The periodic check stays as a fallback for links that fail silently.
+		if(!check && sinceCheck.elapsed() < HEALTH_CHECK_MS) continue;
+		sinceCheck.restart();
+		
+		const bool failed = !isHealthy();
+		if(failed) recover();
+		// A probe that failed on a healthy link is reopened by the next periodic
+		// check instead, so a tty that keeps reporting HUP cannot spin this loop.
+		const bool reopen = failed || ready != ReadinessProbe::Failed;
+		if(!m_devicePath.isEmpty() && !m_probe.isOpen() && reopen) m_probe.open(m_devicePath);
 	}
 }
 
-Transmitter *ServerThread::transmitter() const
+bool ServerThread::linkEvent()
 {
-	return m_transmitter;
+	// Drains every queued uevent; true if any concerned our tty or the gadget controller
+	bool ours = false;
+	DeviceMonitor::Event event;
+	while(m_monitor.next(event)) {
+		ours |= event.devName == m_devName || event.subsystem == "udc" || event.subsystem == "android_usb";
+	}
+	return ours;
 }
 
-KovanSerial *ServerThread::proto() const
+bool ServerThread::isHealthy()
 {
-	return m_proto;
+	// Linux will report an EIO error if the usb device is in an error state.
+	// The only problem is that we have to *write* to get that error code.
+	uint8_t dummy[0];
+	return m_transmitter->write(dummy, 0) >= 0;
 }
 
-bool ServerThread::handle(const Packet &p)
+void ServerThread::recover()
 {
-	//qDebug() << "Got packet of type" << p.type;
-	if(p.type == Command::KnockKnock) m_proto->whosThere();
-	else if(p.type == Command::FileHeader) handleArchive(p);
-	else if(p.type == Command::FileAction) handleAction(p);
-	else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
-	else if(p.type == Command::Hangup) {
-		m_proto->clearSession();
-		return false;
-	}
-	return true;
+	qDebug() << "USB ERROR!!!";
+	QElapsedTimer recovery;
+	recovery.start();
+	
+	m_probe.close();
+	m_transmitter->endSession();
+	attach();
+	if(m_stop) return;
+	
+	Stats::instance()->recordUsbRecovery(recovery.nsecsElapsed() / 1000);
+	qDebug() << "USB link recovered after" << recovery.elapsed() << "ms";
 }
 
-bool ServerThread::handleUntrusted(const Packet &p)
+void ServerThread::attach()
 {
-	//std::cout << "Attempting untrusted command" << std::endl;
-	
-	Config *settings = Config::load(DEVICE_SETTINGS);
-	
-	// Lazy initialization of password
-	if(settings) {
-		settings->beginGroup("kovan_serial");
-		if(!settings->containsKey("password")) m_proto->setNoPassword();
-		else m_proto->setPassword(settings->stringValue("password"));
+	// Retry with bounded exponential backoff; a uevent for the device cuts
+	// the wait short, so the link comes up as soon as the tty enumerates.
+	int backoff = RECONNECT_MIN_MS;
+	while(!m_stop && !m_transmitter->makeAvailable()) {
+		waitForDevice(backoff);
+		backoff = qMin(backoff * 2, RECONNECT_MAX_MS);
 	}
-	delete settings;
-	
-	if(p.type == Command::RequestAuthenticationInfo) {
-		m_proto->sendAuthenticationInfo(m_proto->isPassworded());
-	} else if(p.type == Command::RequestAuthentication) {
-		Command::RequestAuthenticationData data;
-		p.as(data);
-		
-		const bool valid = memcmp(data.password, m_proto->passwordMd5(), 16) == 0;
-		m_proto->confirmAuthentication(valid);
-	} else if(p.type == Command::KnockKnock) {
-		m_proto->whosThere();
-	} else if(p.type == Command::Hangup) {
-		m_proto->clearSession();
-		return false;
-	} else if(p.type == Command::RequestProtocolVersion) {
-		m_proto->sendProtocolVersion();
-	} else if(!m_proto->isPassworded()) {
-		// If there is no password set locally, allow any command
-		return handle(p);
-	} else return false;
-	
-	
-	return true;
 }
 
-void ServerThread::handleArchive(const Packet &headerPacket)
+void ServerThread::waitForDevice(const int timeout)
 {
-	//quint64 start = msystime();
-	
-	Command::FileHeaderData header;
-	headerPacket.as(header);
-	bool good = QString(header.metadata) == "kar";
-	if(!good) {
-		m_proto->confirmFile(false);
+	if(!m_monitor.isOpen()) {
+		usleep(timeout * 1000);
 		return;
 	}
 	
-	// Remove old binary
-	//remove((USER_BINARIES_DIR + KOVAN_SERIAL_PATH_SEP + header.dest).c_str());
-	
-  RootManager root(USER_ROOT);
-	std::ofstream file(root.archivesPath(header.dest).toUtf8(), std::ios::binary);
-	good = file.is_open();
-	if(!m_proto->confirmFile(good) || !good) return;
-	
-	if(!m_proto->recvFile(header.size, &file, 1000)) {
-		qWarning() << "recvFile failed";
-		return;
+	QTime waited;
+	waited.start();
+	DeviceMonitor::Event event;
+	int left = timeout;
+	while(left > 0 && m_monitor.next(event, left)) {
+		if(event.devName == m_devName || event.subsystem == "udc") return;
+		left = timeout - waited.elapsed();
 	}
-	
-	file.close();
-	
-	//quint64 end = msystime();
-	//qDebug() << "Took" << (end - start) << "milliseconds to recv";
 }
 
-void ServerThread::handleAction(const Packet &action)
+Transmitter *ServerThread::transmitter() const
+{
+	return m_transmitter;
+}
+
+KovanSerial *ServerThread::proto() const
 {
-	Command::FileActionData data;
-	action.as(data);
-	
-	const QString type = data.action;
-	std::cout << "Handling action: " << data.action << std::endl;
-	
-	if(type == COMMAND_ACTION_READ) {
-		QFileInfo info(data.dest);
-		if(info.isDir()) {
-			std::stringstream stream;
-			const bool good = info.exists();
-			if(!m_proto->confirmFileAction(good) || !good) return;
-			QList<QFileInfo> entries = info.dir().entryInfoList(QDir::NoDot |
-				QDir::NoDotDot | QDir::Dirs | QDir::Files);
-			foreach(const QFileInfo &entry, entries) {
-				char typeChar = 0;
-				if(entry.isDir()) typeChar = 'd';
-				else if(entry.isFile()) typeChar = 'f';
-				else if(entry.isSymLink()) typeChar = 'l';
-				else typeChar = '?';
-				
-				stream << typeChar << " " << entry.fileName().toStdString() << std::endl;
-			}
-			stream.seekg(0, std::ios_base::beg);
-			if(!m_proto->sendFile(data.dest, "", &stream)) {
-				std::cout << "Sending results failed." << std::endl;
-			}
-			return;
-		}
-		std::ifstream file(data.dest, std::ios::binary);
-		const bool good = file.is_open();
+	return m_session ? m_session->proto() : 0;
+}
 
-		if(!m_proto->confirmFileAction(good) || !good) {
-			std::cout << "Confirm failed with " << good << std::endl;
-			return;
-		}
-		
-		if(!m_proto->sendFile(data.dest, "", &file)) {
-			std::cout << "Sending results failed." << std::endl;
-		}
-		file.close();
-		return;
-	}
-	
-	if(type == COMMAND_ACTION_SCREENSHOT) {
-		system("cat /dev/fb0 > /latest_screenshot.raw565");
-		
-		std::ifstream file("/latest_screenshot.raw565", std::ios::binary);
-		const bool good = file.is_open();
-		if(!m_proto->confirmFileAction(good) || !good) {
-			std::cout << "Confirm failed with " << good << std::endl;
-			return;
-		}
-		if(!m_proto->sendFile("/latest_screenshot.raw565", "", &file)) {
-			std::cout << "Sending results failed." << std::endl;
-		}
-		file.close();
-		std::cout << "Action screenshot finished" << std::endl;
-		return;
-	}
+bool ServerThread::handle(const Packet &p)
+{
+	return m_session->handle(p);
+}
 
-	if(type == COMMAND_ACTION_COMPILE) {
-    RootManager root(USER_ROOT);
-		kiss::KarPtr archive = kiss::Kar::load(root.archivesPath(data.dest));
-		const bool good = !archive.isNull();
-		//qDebug() << "good?" << good;
-		if(!m_proto->confirmFileAction(good) || !good) return;
-    
-    const QStringList cExts = QStringList() << "c" << "cpp" << "cxx" << "cc";
-    bool isCProj = false;
-    Q_FOREACH(const QString &file, archive->files()) {
-      QFileInfo info(file);
-      isCProj |= (bool)cExts.contains(info.completeSuffix(), Qt::CaseInsensitive);
-    }
-    
-    if(isCProj) {
-      QFile file(":/target.c");
-      if(!file.open(QIODevice::ReadOnly)) {
-        qWarning() << "Failed to inject target.c";
-      } else {
-        archive->setFile("__internal_target___.c", file.readAll());
-        file.close();
-      }
-    }
-		
-		CompileWorker *worker = new CompileWorker(archive, m_proto);
-		worker->setName(data.dest);
-		worker->start();
-		worker->wait();
-		
-		//qDebug() << "Sending results...";
-		QByteArray ddata;
-		QDataStream stream(&ddata, QIODevice::WriteOnly);
-		stream << worker->output();
-    
-		std::istringstream sstream;
-		sstream.rdbuf()->pubsetbuf(ddata.data(), ddata.size());
-		if(!m_proto->sendFile("", "col", &sstream)) {
-			qWarning() << "Sending result failed";
-			return;
-		}
-	} else if(type == COMMAND_ACTION_RUN) {
-		const QString binPath = QString::fromStdString(USER_ROOT) + "/bin/" + data.dest + "/" + data.dest;
-		const bool good = QFile::exists(binPath);
-		//qDebug() << "good?" << good;
-		if(!m_proto->confirmFileAction(good) || !good) return;
-		m_proto->sendFileActionProgress(true, 1.0);
-    
-		emit run(binPath);
-	} else m_proto->confirmFileAction(false);
+bool ServerThread::handleUntrusted(const Packet &p)
+{
+	return m_session->handleUntrusted(p);
 }
+
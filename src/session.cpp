@@ -0,0 +1,712 @@
+#include "session.hpp"
+
+#include "compile_worker.hpp"
+#include "compile_scheduler.hpp"
+#include "compile_cache.hpp"
+#include "constants.hpp"
+#include "config_cache.hpp"
+#include "partial_upload.hpp"
+#include "build_tree.hpp"
+#include "mapped_file.hpp"
+#include "framebuffer.hpp"
+#include "screen_encoder.hpp"
+#include "directory_listing.hpp"
+#include "delta_sync.hpp"
+#include "stream_compression.hpp"
+#include "stats.hpp"
+#include "serial_bridge.hpp"
+#include "ticket_store.hpp"
+#include "pipeline.hpp"
+
+#include <kovanserial/transmitter.hpp>
+#include <kovanserial/kovan_serial.hpp>
+#include <kovanserial/command_types.hpp>
+#include <kovanserial/general.hpp>
+#include <kovanserial/md5.hpp>
+#include <kovanserial/platform_defines.hpp>
+
+#include <pcompiler/root_manager.hpp>
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QDir>
+#include <QTime>
+#include <QElapsedTimer>
+#include <QRegExp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+
+// How long the compile wait loop listens for client packets between progress reports.
+#define COMPILE_POLL_MS 100
+
+// How often the client is listened to while botui is asked to launch
+#define LAUNCH_POLL_MS 50
+
+// Pacing and length limit for screenshot streams
+#define SCREEN_STREAM_FPS 10
+#define SCREEN_STREAM_MAX_FRAMES 600
+
+// Largest file READ compresses. The compressed copy is built in memory
+// before sending, so bigger files go out uncompressed straight from the mapping.
+#define READ_COMPRESS_MAX_BYTES (4 * 1024 * 1024)
+
+// Largest compressed kar accepted; it is inflated in memory before it is written
+#define ARCHIVE_MAX_BYTES (64 * 1024 * 1024)
+
+// Largest archive delta accepted. The whole delta is held in memory a few
+// times over while it is received; anything bigger should be sent as a kar.
+#define DELTA_MAX_BYTES (4 * 1024 * 1024)
+
+using namespace Compiler;
+
+Session::Session(Transmitter *transmitter, const Stats::Transport kind)
+	: m_kind(kind),
+	m_transport(new TransportLayer(transmitter)),
+	m_proto(new KovanSerial(m_transport)),
+	m_configGeneration(-1),
+	m_resumed(false),
+	m_compression(false),
+	m_hungUp(false),
+	m_lastFrameWidth(0)
+{
+}
+
+Session::~Session()
+{
+	delete m_proto;
+	delete m_transport;
+}
+
+TransportLayer *Session::transport() const
+{
+	return m_transport;
+}
+
+KovanSerial *Session::proto() const
+{
+	return m_proto;
+}
+
+bool Session::handle(const Packet &p)
+{
+	//qDebug() << "Got packet of type" << p.type;
+	QElapsedTimer timer;
+	timer.start();
+	
+	bool ret = true;
+	if(p.type == Command::KnockKnock) m_proto->whosThere();
+	else if(p.type == Command::FileHeader) handleArchive(p);
+	else if(p.type == Command::FileAction) {
+		Command::FileActionData data;
+		p.as(data);
+		handleAction(p);
+		Stats::instance()->recordAction(m_kind, data.action, timer.nsecsElapsed() / 1000);
+		if(m_hungUp) {
+			m_hungUp = false;
+			m_resumed = false;
+			m_pipeline.cancelAll();
+			ret = false;
+		}
+	} else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
+	else if(p.type == Command::Hangup) {
+		m_proto->clearSession();
+		m_resumed = false;
+		m_pipeline.cancelAll();
+		ret = false;
+	}
+	
+	Stats::instance()->recordCommand(m_kind, p.type, timer.nsecsElapsed() / 1000);
+	return ret;
+}
+
+bool Session::handleUntrusted(const Packet &p)
+{
+	//std::cout << "Attempting untrusted command" << std::endl;
+	// A resumed session is as trusted as an authenticated one
+	if(m_resumed) return handle(p);
+	
+	QElapsedTimer timer;
+	timer.start();
+	
+	// Lazy initialization of password, redone only when the config changes
+	ConfigCache *config = ConfigCache::instance();
+	if(config->generation() != m_configGeneration) {
+		bool loaded = false;
+		bool passworded = false;
+		std::string password;
+		m_configGeneration = config->password(loaded, passworded, password);
+		// Without a config file the current password is left as it is
+		if(loaded && !passworded) m_proto->setNoPassword();
+		else if(loaded) m_proto->setPassword(password);
+	}
+	
+	if(p.type == Command::RequestAuthenticationInfo) {
+		m_proto->sendAuthenticationInfo(m_proto->isPassworded());
+	} else if(p.type == Command::RequestAuthentication) {
+		Command::RequestAuthenticationData data;
+		p.as(data);
+		
+		const bool valid = memcmp(data.password, m_proto->passwordMd5(), 16) == 0;
+		m_proto->confirmAuthentication(valid);
+	} else if(p.type == Command::KnockKnock) {
+		m_proto->whosThere();
+	} else if(p.type == Command::FileAction && isResume(p)) {
+		Command::FileActionData data;
+		p.as(data);
+		m_resumed = TicketStore::instance()->redeem(QByteArray(data.dest));
+		m_proto->confirmFileAction(m_resumed);
+	} else if(p.type == Command::Hangup) {
+		m_proto->clearSession();
+		m_pipeline.cancelAll();
+		Stats::instance()->recordCommand(m_kind, p.type, timer.nsecsElapsed() / 1000);
+		return false;
+	} else if(p.type == Command::RequestProtocolVersion) {
+		m_proto->sendProtocolVersion();
+	} else if(!m_proto->isPassworded()) {
+		// If there is no password set locally, allow any command
+		return handle(p);
+	} else return false;
+	
+	Stats::instance()->recordCommand(m_kind, p.type, timer.nsecsElapsed() / 1000);
+	return true;
+}
+
+bool Session::isTrusted(const TransportLayer::Return ret) const
+{
+	// The same rule handleUntrusted() applies before handing a packet to handle()
+	return ret == TransportLayer::Success || m_resumed || !m_proto->isPassworded();
+}
+
+bool Session::isCancel(const Packet &p)
+{
+	Command::FileActionData data;
+	p.as(data);
+	return QString(data.action) == COMMAND_ACTION_CANCEL;
+}
+
+bool Session::isResume(const Packet &p)
+{
+	Command::FileActionData data;
+	p.as(data);
+	return QString(data.action) == COMMAND_ACTION_RESUME_SESSION;
+}
+
+void Session::handleArchive(const Packet &headerPacket)
+{
+	//quint64 start = msystime();
+	
+	Command::FileHeaderData header;
+	headerPacket.as(header);
+	QString metadata = header.metadata;
+	const bool compressed = metadata.endsWith(StreamCompression::suffix);
+	if(compressed) metadata.chop(qstrlen(StreamCompression::suffix));
+	
+	if(metadata == "kar-part") {
+		handleArchiveChunk(header, compressed);
+		return;
+	}
+	if(metadata == "kar-delta") {
+		handleArchiveDelta(header, compressed);
+		return;
+	}
+	
+	bool good = metadata == "kar";
+	if(!good) {
+		m_proto->confirmFile(false);
+		return;
+	}
+	
+	// Remove old binary
+	//remove((USER_BINARIES_DIR + KOVAN_SERIAL_PATH_SEP + header.dest).c_str());
+	
+  RootManager root(USER_ROOT);
+	// Receive next to the destination and rename over it only once complete,
+	// so a failed transfer never leaves a truncated archive behind.
+	const QString path = root.archivesPath(header.dest);
+	const QString partPath = path + ".part";
+	good = !compressed || header.size <= ARCHIVE_MAX_BYTES;
+	std::ofstream file;
+	if(good) file.open(partPath.toUtf8(), std::ios::binary);
+	good = good && file.is_open();
+	if(!m_proto->confirmFile(good) || !good) return;
+	
+	if(compressed) {
+		QByteArray data;
+		good = recvData(header.size, data, true, ARCHIVE_MAX_BYTES);
+		if(good) file.write(data.constData(), data.size());
+		good = good && file.good();
+	} else {
+		good = m_proto->recvFile(header.size, &file, 1000);
+		if(good) Stats::instance()->addBytesIn(m_kind, header.size);
+	}
+	
+	file.close();
+	if(!good) {
+		qWarning() << "recvFile failed";
+		QFile::remove(partPath);
+		return;
+	}
+	
+	if(::rename(partPath.toUtf8(), path.toUtf8()) != 0) {
+		qWarning() << "Failed to commit" << path;
+	}
+	
+	//quint64 end = msystime();
+	//qDebug() << "Took" << (end - start) << "milliseconds to recv";
+}
+
+void Session::handleArchiveChunk(const Command::FileHeaderData &header, const bool compressed)
+{
+	// dest is "<offset>:<chunk md5>:<name>"
+	const QString dest = header.dest;
+	const QString name = dest.section(':', 2);
+	bool good = false;
+	const qint64 offset = dest.section(':', 0, 0).toLongLong(&good);
+	const QByteArray chunkMd5 = dest.section(':', 1, 1).toLatin1();
+	PartialUpload upload = m_uploads.value(name);
+	// An offset that doesn't continue the held bytes, or a chunk running past
+	// the announced size, is refused before anything is read into memory.
+	// Compressed chunks are bounded while they are inflated instead.
+	good = good && m_uploads.contains(name) && upload.accepts(offset)
+		&& (compressed || qint64(header.size) <= upload.size() - offset);
+	if(!m_proto->confirmFile(good) || !good) return;
+	
+	QByteArray chunk;
+	if(!recvData(header.size, chunk, compressed, upload.size() - offset)) {
+		qWarning() << "recvFile failed";
+		return;
+	}
+	
+	// Checksum and commit failures are only known now; every chunk is
+	// answered with "<accepted> <held> <committed>"
+	const bool accepted = upload.append(offset, chunk, chunkMd5);
+	if(!accepted) qWarning() << "Chunk at" << offset << "of" << name << "rejected";
+	std::stringstream stream;
+	stream << (accepted ? 1 : 0) << " " << upload.held() << " " << (upload.isCommitted() ? 1 : 0) << std::endl;
+	if(!m_proto->sendFile(header.dest, "kar-part-status", &stream)) {
+		qWarning() << "Sending chunk status failed";
+	}
+}
+
+void Session::handleArchiveDelta(const Command::FileHeaderData &header, const bool compressed)
+{
+	RootManager root(USER_ROOT);
+	const QString path = root.archivesPath(header.dest);
+	const bool good = QFileInfo(path).isFile() && header.size <= DELTA_MAX_BYTES;
+	if(!m_proto->confirmFile(good) || !good) return;
+	
+	QByteArray delta;
+	if(!recvData(header.size, delta, compressed, DELTA_MAX_BYTES)) {
+		qWarning() << "recvFile failed";
+		return;
+	}
+	
+	// Answered with "<applied>", so a client whose base was stale knows to
+	// fall back to a full upload
+	const bool applied = DeltaSync::apply(path, delta, ARCHIVE_MAX_BYTES);
+	if(!applied) qWarning() << "Applying delta to" << path << "failed";
+	std::stringstream stream;
+	stream << (applied ? 1 : 0) << std::endl;
+	if(!m_proto->sendFile(header.dest, "kar-delta-status", &stream)) {
+		qWarning() << "Sending delta status failed";
+	}
+}
+
+void Session::handleAction(const Packet &action)
+{
+	Command::FileActionData data;
+	action.as(data);
+	
+	const QString type = data.action;
+	std::cout << "Handling action: " << data.action << std::endl;
+	
+	if(type == COMMAND_ACTION_READ) {
+		if(QFileInfo(data.dest).isDir()) {
+			QByteArray listing;
+			const bool good = DirectoryListing::flat(data.dest, listing);
+			if(!m_proto->confirmFileAction(good) || !good) return;
+			std::istringstream stream(std::string(listing.constData(), listing.size()));
+			if(!m_proto->sendFile(data.dest, "", &stream)) {
+				std::cout << "Sending results failed." << std::endl;
+			}
+			return;
+		}
+		// Serve straight from a read-only mapping rather than an ifstream
+		MappedFile file;
+		const bool good = file.open(data.dest);
+
+		if(!m_proto->confirmFileAction(good) || !good) {
+			std::cout << "Confirm failed with " << good << std::endl;
+			return;
+		}
+		
+		bool sent = false;
+		if(m_compression && file.size() <= READ_COMPRESS_MAX_BYTES) {
+			sent = sendData(data.dest, "", QByteArray::fromRawData(file.data(), file.size()));
+		} else {
+			sent = m_proto->sendFile(data.dest, "", file.stream());
+			if(sent) Stats::instance()->addBytesOut(m_kind, file.size());
+		}
+		if(!sent) {
+			std::cout << "Sending results failed." << std::endl;
+		}
+		if(file.isTruncated()) qWarning() << data.dest << "shrank while being sent";
+		return;
+	}
+	
+	if(type == COMMAND_ACTION_SCREENSHOT) {
+		// Same bytes `cat /dev/fb0` produced, straight from the mapped framebuffer
+		const QByteArray frame = Framebuffer::instance()->grabRaw();
+		const bool good = !frame.isEmpty();
+		if(!m_proto->confirmFileAction(good) || !good) {
+			std::cout << "Confirm failed with " << good << std::endl;
+			return;
+		}
+		if(!sendData("/latest_screenshot.raw565", "", frame)) {
+			std::cout << "Sending results failed." << std::endl;
+		}
+		std::cout << "Action screenshot finished" << std::endl;
+		return;
+	}
+	
+	if(type == COMMAND_ACTION_LIST) {
+		QByteArray listing;
+		const bool good = Pipeline::execute(type, data.dest, listing);
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		if(!sendData(data.dest, COMMAND_ACTION_LIST, listing)) {
+			std::cout << "Sending results failed." << std::endl;
+		}
+		return;
+	}
+	
+	if(type == COMMAND_ACTION_READ_BATCH) {
+		// One bundle with a header and status per file; see BatchRead
+		QByteArray bundle;
+		const bool good = Pipeline::execute(type, data.dest, bundle);
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		if(!sendData("", COMMAND_ACTION_READ_BATCH, bundle)) {
+			std::cout << "Sending results failed." << std::endl;
+		}
+		return;
+	}
+	
+	if(type == COMMAND_ACTION_SCREENSHOT_RLE) {
+		handleScreenshot(data.dest);
+		return;
+	}
+
+	if(type == COMMAND_ACTION_COMPILE || type == COMMAND_ACTION_COMPILE_STREAM) {
+		CompileWorkerPtr worker = CompileWorker::forProject(data.dest);
+		const bool good = !worker.isNull();
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		
+		// Streaming clients get each Output as it is produced and an empty "col" at the end
+		worker->setStreaming(type == COMMAND_ACTION_COMPILE_STREAM);
+		CompileScheduler::instance()->enqueue(worker);
+		// Nobody is left to send results to
+		if(!waitForCompile(worker)) return;
+		
+		// A cancelled job may still be running, so its output is never read
+		const bool cancelled = worker->isCancelled();
+		if(!cancelled) sendDiagnostics(worker);
+		
+		if(!m_proto->sendFileActionProgress(true, 1.0)) {
+			qWarning() << "send terminal file action progress failed.";
+		}
+		
+		const OutputList output = cancelled
+			? OutputList() << Output(data.dest, 1, QByteArray(), "error: compile cancelled")
+			: worker->output();
+		
+		//qDebug() << "Sending results...";
+		QByteArray ddata;
+		QDataStream stream(&ddata, QIODevice::WriteOnly);
+		stream << output;
+    
+		if(!sendData("", "col", ddata)) {
+			qWarning() << "Sending result failed";
+			return;
+		}
+	} else if(type == COMMAND_ACTION_UPLOAD_STATUS) {
+		// dest is "<md5>:<size>:<name>"; replies "<held> <md5 of held> <committed>"
+		const QString dest = data.dest;
+		const QString name = dest.section(':', 2);
+		bool good = false;
+		const qint64 size = dest.section(':', 1, 1).toLongLong(&good);
+		const QByteArray md5 = dest.section(':', 0, 0).toLatin1();
+		// Both the name and the digest end up in file names
+		good = good && size >= 0 && BuildTree::isValidName(name) && PartialUpload::isValidMd5(md5);
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		
+		RootManager root(USER_ROOT);
+		PartialUpload upload(root.archivesPath(name), md5, size);
+		upload.removeAbandoned();
+		m_uploads.insert(name, upload);
+		
+		std::stringstream stream;
+		stream << upload.held() << " " << upload.heldMd5().constData() << " "
+			<< (upload.isCommitted() ? 1 : 0) << std::endl;
+		if(!m_proto->sendFile(data.dest, COMMAND_ACTION_UPLOAD_STATUS, &stream)) {
+			qWarning() << "Sending upload status failed";
+		}
+	} else if(type == COMMAND_ACTION_KAR_SIGNATURE) {
+		QByteArray signature;
+		const bool good = Pipeline::execute(type, data.dest, signature);
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		if(!sendData(data.dest, COMMAND_ACTION_KAR_SIGNATURE, signature)) {
+			qWarning() << "Sending signature failed";
+		}
+	} else if(type == COMMAND_ACTION_COMPRESSION) {
+		// dest names the codec; an empty dest turns compression back off
+		const QByteArray codec = QByteArray(data.dest);
+		const bool good = codec.isEmpty() || StreamCompression::isSupported(codec);
+		if(good) m_compression = !codec.isEmpty();
+		m_proto->confirmFileAction(good);
+	} else if(type == COMMAND_ACTION_STATS) {
+		m_proto->confirmFileAction(true);
+		if(!sendData("", COMMAND_ACTION_STATS, Stats::instance()->toText())) {
+			qWarning() << "Sending stats failed";
+		}
+	} else if(type == COMMAND_ACTION_PIPE) {
+		// dest is "<id>:<action>:<dest>". Only acceptance is confirmed here;
+		// the client sends further requests without waiting for results.
+		const QString dest = data.dest;
+		const QByteArray id = dest.section(':', 0, 0).toUtf8();
+		const bool good = !id.isEmpty() && m_pipeline.submit(id, dest.section(':', 1, 1), dest.section(':', 2));
+		m_proto->confirmFileAction(good);
+	} else if(type == COMMAND_ACTION_PIPE_COLLECT) {
+		// Sends every outstanding response as it completes, with the request
+		// id as dest, then a terminal progress once none are left.
+		m_proto->confirmFileAction(true);
+		if(!collectPipeline()) return;
+		m_proto->sendFileActionProgress(true, 1.0);
+	} else if(type == COMMAND_ACTION_SESSION_TICKET) {
+		// Only reachable once trusted, so the ticket inherits this session's authentication
+		const QByteArray ticket = TicketStore::instance()->issue();
+		const bool good = !ticket.isEmpty();
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		if(!sendData("", COMMAND_ACTION_SESSION_TICKET, ticket)) {
+			qWarning() << "Sending session ticket failed";
+		}
+	} else if(type == COMMAND_ACTION_CANCEL) {
+		m_proto->confirmFileAction(CompileScheduler::instance()->cancel(data.dest));
+	} else if(type == COMMAND_ACTION_RUN) {
+		const QString binPath = QString::fromStdString(USER_ROOT) + "/bin/" + data.dest + "/" + data.dest;
+		const bool good = QFile::exists(binPath);
+		//qDebug() << "good?" << good;
+		if(!m_proto->confirmFileAction(good) || !good) return;
+		
+		// Only this session's thread waits for botui; the final progress
+		// tells the client whether the launch actually happened.
+		bool launched = false;
+		if(!waitForLaunch(SerialBridge::launch(binPath), launched)) return;
+		m_proto->sendFileActionProgress(true, launched ? 1.0 : 0.0);
+	} else m_proto->confirmFileAction(false);
+}
+
+bool Session::waitForCompile(const CompileWorkerPtr &worker)
+{
+	// The compile runs on the scheduler's pool. Meanwhile this thread keeps
+	// reporting progress and answers the commands that are safe mid-compile.
+	// A cancelled job is abandoned right away; the pool reclaims it once
+	// its current stage returns.
+	double reported = -1.0;
+	while(!worker->wait(0) && !worker->isCancelled()) {
+		sendDiagnostics(worker);
+		
+		const double fraction = worker->fraction();
+		if(fraction != reported) {
+			reported = fraction;
+			if(!m_proto->sendFileActionProgress(false, fraction)) {
+				qWarning() << "send file action progress failed.";
+			}
+		}
+		
+		Packet p;
+		const TransportLayer::Return ret = m_transport->recv(p, COMPILE_POLL_MS);
+		if(ret != TransportLayer::Success && ret != TransportLayer::UntrustedSuccess) continue;
+		
+		if(p.type == Command::KnockKnock) m_proto->whosThere();
+		else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
+		else if(p.type == Command::Hangup) {
+			worker->cancel();
+			m_proto->clearSession();
+			m_hungUp = true;
+			return false;
+		} else if(p.type == Command::FileAction) {
+			// Every action is answered; only a trusted cancel is honoured
+			const bool cancel = isTrusted(ret) && isCancel(p);
+			if(cancel) worker->cancel();
+			m_proto->confirmFileAction(cancel);
+		} else qWarning() << "Ignoring packet of type" << p.type << "during compile";
+	}
+	return true;
+}
+
+bool Session::collectPipeline()
+{
+	// Between responses the client is listened to: "cancel" drops whatever
+	// is still outstanding, a Hangup also ends the session.
+	while(m_pipeline.outstanding() > 0) {
+		Pipeline::Response response;
+		if(m_pipeline.next(response, COMPILE_POLL_MS / 2)) {
+			const std::string metadata = response.good ? COMMAND_ACTION_PIPE : "pipe_error";
+			if(!sendData(response.id.constData(), metadata, response.data)) {
+				qWarning() << "Sending pipelined response failed";
+			}
+			continue;
+		}
+		
+		Packet p;
+		const TransportLayer::Return ret = m_transport->recv(p, COMPILE_POLL_MS / 2);
+		if(ret != TransportLayer::Success && ret != TransportLayer::UntrustedSuccess) continue;
+		
+		if(p.type == Command::KnockKnock) m_proto->whosThere();
+		else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
+		else if(p.type == Command::Hangup) {
+			m_pipeline.cancelAll();
+			m_proto->clearSession();
+			m_hungUp = true;
+			return false;
+		} else if(p.type == Command::FileAction) {
+			// Every action is answered; only a trusted cancel drops the requests
+			const bool cancel = isTrusted(ret) && isCancel(p);
+			if(cancel) m_pipeline.cancelAll();
+			m_proto->confirmFileAction(cancel);
+		} else qWarning() << "Ignoring packet of type" << p.type << "during pipe collect";
+	}
+	return true;
+}
+
+bool Session::waitForLaunch(const LaunchTicketPtr &ticket, bool &launched)
+{
+	// The bridge answers every ticket within its timeout, counted from when
+	// it was queued, so the reported result is always what botui did.
+	// This only keeps the client served until then.
+	while(!ticket->wait(LAUNCH_POLL_MS, launched)) {
+		Packet p;
+		const TransportLayer::Return ret = m_transport->recv(p, LAUNCH_POLL_MS);
+		if(ret != TransportLayer::Success && ret != TransportLayer::UntrustedSuccess) continue;
+		
+		if(p.type == Command::KnockKnock) m_proto->whosThere();
+		else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
+		else if(p.type == Command::Hangup) {
+			ticket->abandon();
+			m_proto->clearSession();
+			m_hungUp = true;
+			return false;
+		} else if(p.type == Command::FileAction) m_proto->confirmFileAction(false);
+		else qWarning() << "Ignoring packet of type" << p.type << "during launch";
+	}
+	return true;
+}
+
+void Session::handleScreenshot(const QString &mode)
+{
+	// mode is "" for a key frame, "delta" for a delta against this session's
+	// previous frame, or "stream:<count>" for a paced run of delta frames.
+	Framebuffer *fb = Framebuffer::instance();
+	QRegExp streamMode("stream:(\\d+)");
+	const bool stream = streamMode.exactMatch(mode);
+	const int count = stream ? qBound(1, streamMode.cap(1).toInt(), SCREEN_STREAM_MAX_FRAMES) : 1;
+	const bool known = mode.isEmpty() || mode == "delta" || stream;
+	const bool good = known && fb->isOpen() && fb->bitsPerPixel() == 16;
+	if(!m_proto->confirmFileAction(good) || !good) return;
+	
+	if(mode.isEmpty()) m_lastFrame.clear();
+	
+	QTime pace;
+	for(int i = 0; i < count; ++i) {
+		if(i > 0 && !waitForNextFrame(1000 / SCREEN_STREAM_FPS - pace.elapsed())) return;
+		pace.start();
+		
+		int width = 0;
+		int height = 0;
+		const QByteArray frame = fb->grab(width, height);
+		if(frame.isEmpty() || fb->bitsPerPixel() != 16) {
+			qWarning() << "Framebuffer went away mid-stream";
+			m_lastFrame.clear();
+			return;
+		}
+		// A mode change makes the previous frame useless as a base
+		const bool delta = !m_lastFrame.isEmpty() && m_lastFrameWidth == width
+			&& m_lastFrame.size() == frame.size();
+		const QByteArray encoded = delta
+			? ScreenEncoder::encodeDelta(m_lastFrame, frame, width, height)
+			: ScreenEncoder::encode(frame, width, height);
+		m_lastFrame = frame;
+		m_lastFrameWidth = width;
+		
+		if(!sendData("", delta ? "rle565-delta" : "rle565", encoded)) {
+			qWarning() << "Sending screenshot failed";
+			m_lastFrame.clear();
+			return;
+		}
+	}
+}
+
+bool Session::waitForNextFrame(const int ms)
+{
+	QTime elapsed;
+	elapsed.start();
+	for(int left = ms; left > 0; left = ms - elapsed.elapsed()) {
+		Packet p;
+		const TransportLayer::Return ret = m_transport->recv(p, left);
+		if(ret != TransportLayer::Success && ret != TransportLayer::UntrustedSuccess) continue;
+		
+		if(p.type == Command::KnockKnock) m_proto->whosThere();
+		else if(p.type == Command::RequestProtocolVersion) m_proto->sendProtocolVersion();
+		else if(p.type == Command::Hangup) {
+			m_proto->clearSession();
+			m_hungUp = true;
+			return false;
+		} else if(p.type == Command::FileAction) {
+			// Every action is answered; only a trusted cancel ends the stream
+			const bool cancel = isTrusted(ret) && isCancel(p);
+			m_proto->confirmFileAction(cancel);
+			if(cancel) return false;
+		} else qWarning() << "Ignoring packet of type" << p.type << "during screen stream";
+	}
+	return true;
+}
+
+void Session::sendDiagnostics(const CompileWorkerPtr &worker)
+{
+	foreach(const CompileWorker::Diagnostic &diagnostic, worker->takeDiagnostics()) {
+		if(!sendData("", diagnostic.metadata, diagnostic.data)) {
+			qWarning() << "Sending diagnostic failed";
+		}
+	}
+}
+
+bool Session::sendData(const std::string &dest, const std::string &metadata, const QByteArray &data)
+{
+	// Only sessions that negotiated COMMAND_ACTION_COMPRESSION see compressed payloads
+	const QByteArray payload = m_compression ? StreamCompression::compress(data) : data;
+	const std::string tag = m_compression ? metadata + StreamCompression::suffix : metadata;
+	
+	// The stream only reads from the buffer, so it can wrap the array in place
+	std::istringstream sstream;
+	sstream.rdbuf()->pubsetbuf(const_cast<char *>(payload.constData()), payload.size());
+	if(!m_proto->sendFile(dest, tag, &sstream)) return false;
+	Stats::instance()->addBytesOut(m_kind, payload.size());
+	return true;
+}
+
+bool Session::recvData(const size_t size, QByteArray &out, const bool compressed, const qint64 maxBytes)
+{
+	std::ostringstream stream;
+	if(!m_proto->recvFile(size, &stream, 1000)) return false;
+	Stats::instance()->addBytesIn(m_kind, size);
+	
+	const std::string data = stream.str();
+	out = QByteArray(data.data(), data.size());
+	if(!compressed) return true;
+	
+	const QByteArray payload = out;
+	return StreamCompression::decompress(payload, out, maxBytes);
+}
@@ -0,0 +1,72 @@
+#include "socket_transmitter.hpp"
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Upper bound on how long a single read() waits for data. The transport
+// layer applies its own packet timeouts on top of this.
+#define READ_SLICE_MS 100
+
+SocketTransmitter::SocketTransmitter(const int fd)
+	: m_fd(fd)
+{
+}
+
+SocketTransmitter::~SocketTransmitter()
+{
+	endSession();
+}
+
+bool SocketTransmitter::makeAvailable()
+{
+	return m_fd >= 0;
+}
+
+void SocketTransmitter::endSession()
+{
+	if(m_fd < 0) return;
+	::shutdown(m_fd, SHUT_RDWR);
+	::close(m_fd);
+	m_fd = -1;
+}
+
+ssize_t SocketTransmitter::write(const uint8_t *data, const size_t &len)
+{
+	if(m_fd < 0) return -1;
+	
+	size_t written = 0;
+	while(written < len) {
+		const ssize_t ret = ::send(m_fd, data + written, len - written, MSG_NOSIGNAL);
+		if(ret < 0 && errno == EINTR) continue;
+		if(ret < 0) return -1;
+		written += ret;
+	}
+	return written;
+}
+
+ssize_t SocketTransmitter::read(uint8_t *data, const size_t &len)
+{
+	if(m_fd < 0) return -1;
+	
+	pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	
+	int ret = 0;
+	do ret = poll(&pfd, 1, READ_SLICE_MS);
+	while(ret < 0 && errno == EINTR);
+	if(ret <= 0) return -1;
+	
+	ssize_t r = 0;
+	do r = ::recv(m_fd, data, len, 0);
+	while(r < 0 && errno == EINTR);
+	return r;
+}
+
+int SocketTransmitter::fd() const
+{
+	return m_fd;
+}
@@ -0,0 +1,167 @@
+#include "stats.hpp"
+#include "constants.hpp"
+#include "compile_cache.hpp"
+
+#include <kovanserial/command_types.hpp>
+
+#include <QTextStream>
+
+// Actions with their own series; anything else is counted as "other".
+static const char *const s_actions[] = {
+	COMMAND_ACTION_READ,
+	COMMAND_ACTION_SCREENSHOT,
+	COMMAND_ACTION_COMPILE,
+	COMMAND_ACTION_RUN,
+	COMMAND_ACTION_CANCEL,
+	COMMAND_ACTION_COMPILE_STREAM,
+	COMMAND_ACTION_UPLOAD_STATUS,
+	COMMAND_ACTION_SCREENSHOT_RLE,
+	COMMAND_ACTION_LIST,
+	COMMAND_ACTION_KAR_SIGNATURE,
+	COMMAND_ACTION_COMPRESSION,
+	COMMAND_ACTION_STATS,
+	COMMAND_ACTION_SESSION_TICKET,
+	COMMAND_ACTION_PIPE,
+	COMMAND_ACTION_PIPE_COLLECT,
+	COMMAND_ACTION_READ_BATCH,
+	0
+};
+
+void Histogram::record(const qint64 usecs)
+{
+	int i = 0;
+	while(i < STATS_BUCKETS - 1 && (qint64(2) << i) < usecs) ++i;
+	m_buckets[i].fetchAndAddRelaxed(1);
+	// Carry into the high half when the low half wraps
+	const quint32 low = quint32(usecs);
+	const quint32 before = quint32(m_sumLow.fetchAndAddRelaxed(int(low)));
+	const int carry = quint32(before + low) < before ? 1 : 0;
+	m_sumHigh.fetchAndAddRelaxed(int(quint64(usecs) >> 32) + carry);
+	m_count.fetchAndAddRelaxed(1);
+}
+
+int Histogram::count() const
+{
+	return m_count;
+}
+
+qint64 Histogram::sum() const
+{
+	// Retry if the high half moved while the low half was read
+	for(;;) {
+		const int high = m_sumHigh;
+		const quint32 low = quint32(int(m_sumLow));
+		if(high == int(m_sumHigh)) return (qint64(high) << 32) | low;
+	}
+}
+
+int Histogram::bucket(const int i) const
+{
+	return m_buckets[i];
+}
+
+void Stats::recordCommand(const Transport transport, const int type, const qint64 usecs)
+{
+	m_commands[transport][qBound(0, type, STATS_MAX_COMMANDS - 1)].record(usecs);
+}
+
+void Stats::recordAction(const Transport transport, const QString &action, const qint64 usecs)
+{
+	m_actions[transport][actionIndex(action)].record(usecs);
+}
+
+void Stats::addBytesIn(const Transport transport, const int bytes)
+{
+	m_bytesIn[transport].fetchAndAddRelaxed(bytes);
+}
+
+void Stats::addBytesOut(const Transport transport, const int bytes)
+{
+	m_bytesOut[transport].fetchAndAddRelaxed(bytes);
+}
+
+void Stats::recordUsbRecovery(const qint64 usecs)
+{
+	m_usbRecoveries.record(usecs);
+}
+
+static void writeHistogram(QTextStream &out, const char *name, const QString &labels, const Histogram &h)
+{
+	if(!h.count()) return;
+	
+	const QString sep = labels.isEmpty() ? "" : ",";
+	int cumulative = 0;
+	for(int i = 0; i < STATS_BUCKETS - 1; ++i) {
+		cumulative += h.bucket(i);
+		out << name << "_bucket{" << labels << sep << "le=\"" << (qint64(2) << i) << "\"} " << cumulative << "\n";
+	}
+	out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << h.count() << "\n";
+	out << name << "_sum{" << labels << "} " << h.sum() << "\n";
+	out << name << "_count{" << labels << "} " << h.count() << "\n";
+}
+
+QByteArray Stats::toText() const
+{
+	QByteArray ret;
+	QTextStream out(&ret, QIODevice::WriteOnly);
+	
+	out << "# TYPE kovan_serial_command_us histogram\n";
+	for(int t = 0; t < TransportCount; ++t) {
+		for(int c = 0; c < STATS_MAX_COMMANDS; ++c) {
+			writeHistogram(out, "kovan_serial_command_us", QString("transport=\"%1\",command=\"%2\"")
+				.arg(transportName(t)).arg(c), m_commands[t][c]);
+		}
+	}
+	
+	out << "# TYPE kovan_serial_action_us histogram\n";
+	for(int t = 0; t < TransportCount; ++t) {
+		for(int a = 0; a < STATS_MAX_ACTIONS; ++a) {
+			const char *name = a < int(sizeof(s_actions) / sizeof(*s_actions)) - 1 ? s_actions[a] : "other";
+			writeHistogram(out, "kovan_serial_action_us", QString("transport=\"%1\",action=\"%2\"")
+				.arg(transportName(t)).arg(name), m_actions[t][a]);
+		}
+	}
+	
+	out << "# TYPE kovan_serial_bytes_in counter\n";
+	for(int t = 0; t < TransportCount; ++t) {
+		out << "kovan_serial_bytes_in{transport=\"" << transportName(t) << "\"} " << quint32(int(m_bytesIn[t])) << "\n";
+	}
+	out << "# TYPE kovan_serial_bytes_out counter\n";
+	for(int t = 0; t < TransportCount; ++t) {
+		out << "kovan_serial_bytes_out{transport=\"" << transportName(t) << "\"} " << quint32(int(m_bytesOut[t])) << "\n";
+	}
+	
+	out << "# TYPE kovan_serial_usb_recovery_us histogram\n";
+	writeHistogram(out, "kovan_serial_usb_recovery_us", QString(), m_usbRecoveries);
+	
+	CompileCache *cache = CompileCache::instance();
+	out << "# TYPE kovan_serial_compile_cache_hits counter\n";
+	out << "kovan_serial_compile_cache_hits " << cache->hits() << "\n";
+	out << "# TYPE kovan_serial_compile_cache_misses counter\n";
+	out << "kovan_serial_compile_cache_misses " << cache->misses() << "\n";
+	
+	out.flush();
+	return ret;
+}
+
+Stats *Stats::instance()
+{
+	static Stats s_instance;
+	return &s_instance;
+}
+
+Stats::Stats()
+{
+}
+
+int Stats::actionIndex(const QString &action)
+{
+	int i = 0;
+	for(; s_actions[i]; ++i) if(action == s_actions[i]) return i;
+	return qMin(i, STATS_MAX_ACTIONS - 1);
+}
+
+const char *Stats::transportName(const int transport)
+{
+	return transport == Usb ? "usb" : "tcp";
+}
@@ -0,0 +1,36 @@
+#include "stats_exporter.hpp"
+
+#include "stats.hpp"
+
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDebug>
+
+#define DBUS_SERVICE "org.kipr.Serial"
+#define DBUS_PATH "/org/kipr/Serial"
+
+StatsExporter::StatsExporter(QObject *parent)
+	: QObject(parent)
+{
+}
+
+bool StatsExporter::registerOnBus()
+{
+	QDBusConnection bus = QDBusConnection::systemBus();
+	if(!bus.isConnected()) {
+		qWarning() << "No system bus; stats are only available through the stats action";
+		return false;
+	}
+	
+	if(!bus.registerObject(DBUS_PATH, this, QDBusConnection::ExportScriptableSlots)) return false;
+	if(!bus.registerService(DBUS_SERVICE)) {
+		qWarning() << "Failed to claim" << DBUS_SERVICE << bus.lastError().message();
+		return false;
+	}
+	return true;
+}
+
+QString StatsExporter::Stats() const
+{
+	return QString::fromLatin1(::Stats::instance()->toText());
+}
@@ -0,0 +1,57 @@
+#include "stream_compression.hpp"
+
+#include <QDataStream>
+
+#include <zlib.h>
+
+#define STREAM_COMPRESSION_BLOCK (64 * 1024)
+#define STREAM_COMPRESSION_LEVEL 1
+
+const char *const StreamCompression::suffix = "+z";
+
+bool StreamCompression::isSupported(const QByteArray &codec)
+{
+	return codec == "zlib";
+}
+
+QByteArray StreamCompression::compress(const QByteArray &data)
+{
+	QByteArray ret;
+	QDataStream stream(&ret, QIODevice::WriteOnly);
+	for(int i = 0; i < data.size(); i += STREAM_COMPRESSION_BLOCK) {
+		const int len = qMin(STREAM_COMPRESSION_BLOCK, data.size() - i);
+		stream << qCompress(reinterpret_cast<const uchar *>(data.constData() + i), len,
+			STREAM_COMPRESSION_LEVEL);
+	}
+	stream << QByteArray();
+	return ret;
+}
+
+bool StreamCompression::decompress(const QByteArray &data, QByteArray &out, const qint64 maxBytes)
+{
+	out.clear();
+	QDataStream stream(data);
+	for(;;) {
+		QByteArray block;
+		stream >> block;
+		if(stream.status() != QDataStream::Ok) return false;
+		if(block.isEmpty()) return true;
+		if(block.size() < 4) return false;
+		
+		// qCompress output is the inflated size, big-endian, then a zlib
+		// stream. qUncompress trusts that size and grows past it, so the
+		// block is inflated into a buffer of exactly the declared size.
+		const uchar *head = reinterpret_cast<const uchar *>(block.constData());
+		const quint32 declared = (quint32(head[0]) << 24) | (quint32(head[1]) << 16)
+			| (quint32(head[2]) << 8) | quint32(head[3]);
+		if(declared == 0 || declared > STREAM_COMPRESSION_BLOCK) return false;
+		if(out.size() + qint64(declared) > maxBytes) return false;
+		
+		const int at = out.size();
+		out.resize(at + declared);
+		uLongf len = declared;
+		const int ret = uncompress(reinterpret_cast<Bytef *>(out.data() + at), &len,
+			reinterpret_cast<const Bytef *>(block.constData() + 4), block.size() - 4);
+		if(ret != Z_OK || len != declared) return false;
+	}
+}
@@ -0,0 +1,107 @@
+#include "target_shim.hpp"
+#include "constants.hpp"
+#include "unit_compiler.hpp"
+
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QHash>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+
+#include <cstdio>
+
+#define SHIM_RESOURCE ":/target.c"
+#define SHIM_DIR (QString(BUILD_ROOT) + "/.shim")
+#define SHIM_SOURCE "__internal_target___.c"
+
+// Guards the shim directory and the number of builds using each object
+static QMutex s_mutex;
+static QHash<QString, int> s_users;
+
+TargetShim::Use::Use(const Compiler::Options &options, Compiler::Output &failure)
+	: m_object(acquire(options, failure))
+{
+}
+
+TargetShim::Use::~Use()
+{
+	if(!m_object.isEmpty()) release(m_object);
+}
+
+const QString &TargetShim::Use::object() const
+{
+	return m_object;
+}
+
+QString TargetShim::acquire(const Compiler::Options &options, Compiler::Output &failure)
+{
+	QFile resource(SHIM_RESOURCE);
+	if(!resource.open(QIODevice::ReadOnly)) {
+		failure = Compiler::Output(SHIM_SOURCE, 1, QByteArray(), "error: failed to load target.c");
+		return QString();
+	}
+	const QByteArray source = resource.readAll();
+	
+	const QString dir = SHIM_DIR;
+	const QString object = dir + "/" + key(options, source) + ".o";
+	
+	// Concurrent jobs would otherwise build the same object at once
+	QMutexLocker locker(&s_mutex);
+	if(QFile::exists(object)) {
+		++s_users[object];
+		return object;
+	}
+	
+	// A different toolchain or shim leaves stale objects behind
+	removeStale(dir, object);
+	QDir().mkpath(dir);
+	
+	const QString sourcePath = dir + "/" SHIM_SOURCE;
+	QFile file(sourcePath);
+	if(!file.open(QIODevice::WriteOnly) || file.write(source) != source.size()) {
+		failure = Compiler::Output(SHIM_SOURCE, 1, QByteArray(), "error: failed to write target.c");
+		return QString();
+	}
+	file.close();
+	
+	// Built beside its final name and renamed, so a crash never leaves a
+	// truncated object that looks valid. target.c only needs the toolchain's
+	// own headers, so the shim is built with SHIM_DIR as its include path,
+	// not any project's; that is what lets one object serve every project.
+	const QString part = object + ".part";
+	UnitCompiler units(options, dir);
+	failure = units.compile(sourcePath, part);
+	if(!failure.isSuccess() || ::rename(QFile::encodeName(part).constData(),
+		QFile::encodeName(object).constData()) != 0) {
+		QFile::remove(part);
+		return QString();
+	}
+	++s_users[object];
+	return object;
+}
+
+void TargetShim::release(const QString &object)
+{
+	QMutexLocker locker(&s_mutex);
+	if(--s_users[object] <= 0) s_users.remove(object);
+}
+
+void TargetShim::removeStale(const QString &dir, const QString &current)
+{
+	// Called with s_mutex held. Objects a link is still using stay until a
+	// later rebuild finds them unused.
+	foreach(const QFileInfo &entry, QDir(dir).entryInfoList(QStringList() << "*.o", QDir::Files)) {
+		const QString path = entry.filePath();
+		if(path != current && !s_users.contains(path)) QFile::remove(path);
+	}
+}
+
+QString TargetShim::key(const Compiler::Options &options, const QByteArray &source)
+{
+	// The include path is fixed, so the fingerprint only tracks the toolchain and flags
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(UnitCompiler(options, SHIM_DIR).fingerprint().toLatin1());
+	hash.addData(source);
+	return hash.result().toHex();
+}
@@ -1,26 +1,120 @@
 #include "tcp_server_thread.hpp"
 
-#include <kovanserial/tcp_server.hpp>
+#include "session.hpp"
+#include "socket_transmitter.hpp"
+
 #include <kovanserial/transport_layer.hpp>
 #include <kovanserial/kovan_serial.hpp>
+#include <QRunnable>
 #include <QDebug>
 
-TcpServerThread::TcpServerThread(TcpServer *transmitter)
-	: ServerThread(transmitter)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+// How long accept waits before re-checking isStopping().
+#define ACCEPT_WAIT_MS 250
+#define LISTEN_BACKLOG 16
+
+class TcpSessionTask : public QRunnable
+{
+public:
+	TcpSessionTask(const int fd, TcpServerThread *owner)
+		: m_fd(fd),
+		m_owner(owner)
+	{
+	}
+	
+	void run()
+	{
+		SocketTransmitter transmitter(m_fd);
+		Session session(&transmitter, Stats::Tcp);
+		
+		Packet p;
+		while(!m_owner->isStopping()) {
+			TransportLayer::Return ret = session.proto()->next(p, 5000);
+			if(ret == TransportLayer::Success && session.handle(p)); //std::cout << "Handled trusted command" << std::endl;
+			else if(ret == TransportLayer::UntrustedSuccess && session.handleUntrusted(p)); //std::cout << "Handled untrusted command" << std::endl;
+			else break;
+		}
+		transmitter.endSession();
+		m_owner->m_sessions.fetchAndAddOrdered(-1);
+	}
+	
+private:
+	int m_fd;
+	TcpServerThread *m_owner;
+};
+
+TcpServerThread::TcpServerThread(const quint16 port, const int maxSessions)
+	: ServerThread(0),
+	m_port(port),
+	m_fd(-1),
+	m_maxSessions(maxSessions),
+	m_sessions(0)
 {
+	m_pool.setMaxThreadCount(maxSessions);
+}
+
+TcpServerThread::~TcpServerThread()
+{
+	m_pool.waitForDone();
+	if(m_fd >= 0) ::close(m_fd);
+}
+
+bool TcpServerThread::listen()
+{
+	m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if(m_fd < 0) return false;
+	
+	int yes = 1;
+	setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(m_port);
+	
+	if(::bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+		|| ::listen(m_fd, LISTEN_BACKLOG) < 0) {
+		::close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	return true;
 }
 
 void TcpServerThread::run()
 {
-	Packet p;
 	while(!isStopping()) {
-		QThread::msleep(100);
-		if(!dynamic_cast<TcpServer *>(transmitter())->accept(1)) continue;
-		for(;;) {
-			TransportLayer::Return ret = proto()->next(p, 5000);
-			if(ret == TransportLayer::Success && handle(p)); //std::cout << "Handled trusted command" << std::endl;
-			else if(ret == TransportLayer::UntrustedSuccess && handleUntrusted(p)); //std::cout << "Handled untrusted command" << std::endl;
-			else break;
+		pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if(poll(&pfd, 1, ACCEPT_WAIT_MS) <= 0) continue;
+		
+		const int client = ::accept(m_fd, 0, 0);
+		if(client < 0) continue;
+		
+		// Commands are small request/response exchanges; don't let Nagle hold them back.
+		int yes = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		
+		// Every connection gets its own thread for its whole lifetime. Past the
+		// cap a client is refused outright rather than queued behind sessions
+		// that may be busy uploading or compiling.
+		if(m_sessions.fetchAndAddOrdered(1) >= m_maxSessions) {
+			m_sessions.fetchAndAddOrdered(-1);
+			qWarning() << "Refusing TCP client: all" << m_maxSessions << "sessions in use";
+			::close(client);
+			continue;
 		}
+		m_pool.start(new TcpSessionTask(client, this));
 	}
-}
\ No newline at end of file
+	m_pool.waitForDone();
+}
@@ -0,0 +1,79 @@
+#include "ticket_store.hpp"
+#include "constants.hpp"
+#include "config_cache.hpp"
+
+#include <QFile>
+#include <QCryptographicHash>
+
+#define TICKET_BYTES 16
+// Oldest tickets are dropped beyond this many live ones
+#define TICKET_MAX 64
+
+QByteArray TicketStore::issue()
+{
+	QFile random("/dev/urandom");
+	if(!random.open(QIODevice::ReadOnly)) return QByteArray();
+	const QByteArray bytes = random.read(TICKET_BYTES);
+	if(bytes.size() != TICKET_BYTES) return QByteArray();
+	const QByteArray ticket = bytes.toHex();
+	
+	Entry entry;
+	entry.credential = credential();
+	if(entry.credential.isEmpty()) return QByteArray();
+	
+	QMutexLocker locker(&m_mutex);
+	const qint64 now = m_clock.elapsed();
+	purge(now);
+	
+	entry.expires = now + SESSION_TICKET_TTL_MS;
+	m_tickets.insert(ticket, entry);
+	return ticket;
+}
+
+bool TicketStore::redeem(const QByteArray &ticket)
+{
+	QMutexLocker locker(&m_mutex);
+	purge(m_clock.elapsed());
+	
+	// Single use, so a ticket seen on the wire can't be replayed
+	const QByteArray issuedUnder = m_tickets.take(ticket).credential;
+	return !issuedUnder.isEmpty() && issuedUnder == credential();
+}
+
+TicketStore *TicketStore::instance()
+{
+	static TicketStore s_instance;
+	return &s_instance;
+}
+
+TicketStore::TicketStore()
+{
+	m_clock.start();
+}
+
+QByteArray TicketStore::credential()
+{
+	// Unrelated config changes (e.g. the device name) leave tickets valid
+	bool loaded = false;
+	bool passworded = false;
+	std::string password;
+	ConfigCache::instance()->password(loaded, passworded, password);
+	if(!loaded) return QByteArray();
+	
+	const QByteArray settings = (passworded ? "1:" : "0:") + QByteArray(password.data(), password.size());
+	return QCryptographicHash::hash(settings, QCryptographicHash::Md5);
+}
+
+void TicketStore::purge(const qint64 now)
+{
+	QHash<QByteArray, Entry>::iterator oldest = m_tickets.end();
+	for(QHash<QByteArray, Entry>::iterator it = m_tickets.begin(); it != m_tickets.end();) {
+		if(it->expires <= now) {
+			it = m_tickets.erase(it);
+			continue;
+		}
+		if(oldest == m_tickets.end() || it->expires < oldest->expires) oldest = it;
+		++it;
+	}
+	if(m_tickets.size() >= TICKET_MAX && oldest != m_tickets.end()) m_tickets.erase(oldest);
+}
@@ -0,0 +1,162 @@
+#include "unit_compiler.hpp"
+
+#include <QCryptographicHash>
+#include <QProcess>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+
+// Keys mirror the ones pcompiler's C and C++ compilers read from platform.hints
+#define CC_KEY "CC"
+#define CXX_KEY "CXX"
+#define C_FLAGS_KEY "C_FLAGS"
+#define CPP_FLAGS_KEY "CPP_FLAGS"
+
+#define DEPS_SUFFIX ".d"
+#define LOG_SUFFIX ".log"
+
+UnitCompiler::UnitCompiler(const Compiler::Options &options, const QString &includePath)
+	: m_cc(options.value(CC_KEY, "gcc")),
+	m_cxx(options.value(CXX_KEY, "g++")),
+	m_cFlags(options.value(C_FLAGS_KEY).split(" ", QString::SkipEmptyParts)),
+	m_cppFlags(options.value(CPP_FLAGS_KEY).split(" ", QString::SkipEmptyParts)),
+	m_includePath(includePath)
+{
+}
+
+bool UnitCompiler::isUnit(const QString &file)
+{
+	const QString suffix = QFileInfo(file).suffix().toLower();
+	return suffix == "c" || isCpp(file);
+}
+
+QString UnitCompiler::fingerprint() const
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData((QStringList() << m_cc << m_cxx << m_cFlags.join(" ")
+		<< m_cppFlags.join(" ") << m_includePath).join("\n").toUtf8());
+	return hash.result().toHex();
+}
+
+bool UnitCompiler::isStale(const QString &source, const QString &object) const
+{
+	const QFileInfo objectInfo(object);
+	if(!objectInfo.exists()) return true;
+	const QDateTime built = objectInfo.lastModified();
+	
+	QStringList deps;
+	QFile depFile(object + DEPS_SUFFIX);
+	if(depFile.open(QIODevice::ReadOnly)) deps = parseDeps(QString::fromLocal8Bit(depFile.readAll()));
+	if(deps.isEmpty()) deps << source;
+	
+	foreach(const QString &dep, deps) {
+		const QFileInfo info(dep);
+		// Qt 4 mtimes have one second resolution, so a source rewritten in
+		// the second its object was built counts as newer
+		if(!info.exists() || info.lastModified() >= built) return true;
+	}
+	return false;
+}
+
+Compiler::Output UnitCompiler::compile(const QString &source, const QString &object,
+	Listener *listener) const
+{
+	QDir().mkpath(QFileInfo(object).absolutePath());
+	
+	const QString program = isCpp(source) ? m_cxx : m_cc;
+	QProcess process;
+	process.setReadChannel(QProcess::StandardError);
+	process.start(program, arguments(source, object));
+	if(!process.waitForStarted()) {
+		QFile::remove(object);
+		return Compiler::Output(source, 1, QByteArray(),
+			("error: failed to run " + program).toUtf8());
+	}
+	
+	// Hand stderr out line by line while the compiler is still running
+	QByteArray err;
+	while(process.waitForReadyRead(-1)) {
+		while(process.canReadLine()) {
+			const QByteArray line = process.readLine();
+			err += line;
+			if(listener) listener->line(source, line);
+		}
+	}
+	process.waitForFinished(-1);
+	err += process.readAllStandardError();
+	
+	const QByteArray out = process.readAllStandardOutput();
+	const int exitCode = process.exitStatus() == QProcess::NormalExit ? process.exitCode() : 1;
+	
+	// A failed unit must be rebuilt next time even if nothing changes
+	if(exitCode != 0) QFile::remove(object);
+	
+	QFile log(object + LOG_SUFFIX);
+	if(log.open(QIODevice::WriteOnly | QIODevice::Truncate)) log.write(err);
+	
+	return Compiler::Output(source, exitCode, out, err);
+}
+
+Compiler::Output UnitCompiler::replay(const QString &source, const QString &object) const
+{
+	QFile log(object + LOG_SUFFIX);
+	QByteArray err;
+	if(log.open(QIODevice::ReadOnly)) err = log.readAll();
+	return Compiler::Output(source, 0, QByteArray(), err);
+}
+
+QStringList UnitCompiler::parseDeps(const QString &rules)
+{
+	// Make syntax: "object.o: source dep1 dep2 \" with continuation lines.
+	// gcc escapes spaces and '#' in paths with a backslash and '$' as "$$".
+	QStringList ret;
+	const int colon = rules.indexOf(": ");
+	if(colon < 0) return ret;
+	
+	QString current;
+	for(int i = colon + 2; i < rules.size(); ++i) {
+		const QChar c = rules[i];
+		if(c == '\\' && i + 1 < rules.size()) {
+			const QChar next = rules[i + 1];
+			if(next == '\n') {
+				++i;
+			} else if(next == ' ' || next == '#' || next == '\\') {
+				current += next;
+				++i;
+				continue;
+			} else {
+				current += c;
+				continue;
+			}
+		} else if(c == '$' && i + 1 < rules.size() && rules[i + 1] == '$') {
+			current += c;
+			++i;
+			continue;
+		} else if(!c.isSpace()) {
+			current += c;
+			continue;
+		}
+		
+		if(!current.isEmpty()) ret << current;
+		current.clear();
+		// An unescaped newline ends the object's rule
+		if(c == '\n') return ret;
+	}
+	if(!current.isEmpty()) ret << current;
+	return ret;
+}
+
+bool UnitCompiler::isCpp(const QString &file)
+{
+	const QString suffix = QFileInfo(file).suffix().toLower();
+	return suffix == "cpp" || suffix == "cxx" || suffix == "cc";
+}
+
+QStringList UnitCompiler::arguments(const QString &source, const QString &object) const
+{
+	return QStringList() << (isCpp(source) ? m_cppFlags : m_cFlags)
+		<< "-I" + m_includePath
+		<< "-MMD" << "-MF" << object + DEPS_SUFFIX
+		<< "-c" << source << "-o" << object;
+}